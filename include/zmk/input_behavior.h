@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/iterable_sections.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/dt-bindings/input/input-event-codes.h>
+#include <zmk/behavior.h>
+
+/*
+ * Listeners call binding_pressed()/binding_released() of an input behavior with the binding
+ * embedded in this struct, next to the behavior device they resolved at init, so the behavior
+ * gets its device without looking the binding's name up on every input event.
+ */
+struct zmk_input_behavior_binding {
+    struct zmk_behavior_binding binding;
+    const struct device *dev;
+};
+
+static inline const struct device *
+zmk_input_behavior_binding_dev(struct zmk_behavior_binding *binding) {
+    return CONTAINER_OF(binding, struct zmk_input_behavior_binding, binding)->dev;
+}
+
+/*
+ * Lock-free single-producer/single-consumer ring indices. The caller owns the slot array
+ * (power of two length) and only touches slots handed out by the produce/consume helpers:
+ * the producer writes slot produce_idx() and then commits, the consumer reads slot
+ * consume_idx() and then releases it.
+ */
+struct zmk_input_behavior_spsc {
+    atomic_t head;
+    atomic_t tail;
+};
+
+static inline bool zmk_input_behavior_spsc_full(const struct zmk_input_behavior_spsc *ring,
+                                                uint32_t len) {
+    return (uint32_t)(atomic_get(&ring->head) - atomic_get(&ring->tail)) >= len;
+}
+
+static inline uint32_t zmk_input_behavior_spsc_space(const struct zmk_input_behavior_spsc *ring,
+                                                     uint32_t len) {
+    return len - (uint32_t)(atomic_get(&ring->head) - atomic_get(&ring->tail));
+}
+
+static inline bool zmk_input_behavior_spsc_empty(const struct zmk_input_behavior_spsc *ring) {
+    return atomic_get(&ring->head) == atomic_get(&ring->tail);
+}
+
+static inline uint32_t
+zmk_input_behavior_spsc_produce_idx(const struct zmk_input_behavior_spsc *ring, uint32_t len) {
+    return (uint32_t)atomic_get(&ring->head) & (len - 1);
+}
+
+static inline void zmk_input_behavior_spsc_produce_commit(struct zmk_input_behavior_spsc *ring) {
+    atomic_inc(&ring->head);
+}
+
+static inline uint32_t
+zmk_input_behavior_spsc_consume_idx(const struct zmk_input_behavior_spsc *ring, uint32_t len) {
+    return (uint32_t)atomic_get(&ring->tail) & (len - 1);
+}
+
+static inline void zmk_input_behavior_spsc_consume_release(struct zmk_input_behavior_spsc *ring) {
+    atomic_inc(&ring->tail);
+}
+
+/*
+ * Frame API. Listeners with `frame-mode` collect every event up to the input sync and hand the
+ * whole frame to each binding once, instead of calling it per input_event with the event
+ * pointer tucked into zmk_behavior_binding_event.position. Behaviors opt in by registering a
+ * frame handler for their instances; bindings without one keep receiving the per-event calls.
+ */
+struct zmk_input_behavior_frame {
+    int32_t x;
+    int32_t y;
+    int32_t wheel;
+    int32_t hwheel;
+    uint8_t button_set;
+    uint8_t button_clear;
+    uint8_t layer;
+    int64_t timestamp;
+};
+
+typedef int (*zmk_input_behavior_frame_process_t)(const struct device *dev,
+                                                  struct zmk_behavior_binding *binding,
+                                                  struct zmk_input_behavior_frame *frame);
+
+struct zmk_input_behavior_frame_api {
+    const struct device *dev;
+    zmk_input_behavior_frame_process_t process;
+};
+
+#define ZMK_INPUT_BEHAVIOR_FRAME_API_DT_INST_DEFINE(n, fn)                                         \
+    static const STRUCT_SECTION_ITERABLE(                                                          \
+        zmk_input_behavior_frame_api, _CONCAT(zmk_input_behavior_frame_api_, DT_DRV_INST(n))) = {  \
+        .dev = DEVICE_DT_INST_GET(n),                                                              \
+        .process = fn,                                                                             \
+    };
+
+/*
+ * Held-back motion. Behaviors that keep part of the motion back from one event to the next
+ * (filters) register a flush for their instances. Once a listener has seen no input for
+ * ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS it has them add what they hold to an empty frame and runs
+ * that frame through the bindings after them, so a stroke ends where the input ended.
+ */
+#define ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS 100
+
+typedef void (*zmk_input_behavior_flush_t)(const struct device *dev,
+                                           struct zmk_behavior_binding *binding,
+                                           struct zmk_input_behavior_frame *frame);
+
+struct zmk_input_behavior_flush_api {
+    const struct device *dev;
+    zmk_input_behavior_flush_t flush;
+};
+
+#define ZMK_INPUT_BEHAVIOR_FLUSH_API_DT_INST_DEFINE(n, fn)                                         \
+    static const STRUCT_SECTION_ITERABLE(                                                          \
+        zmk_input_behavior_flush_api, _CONCAT(zmk_input_behavior_flush_api_, DT_DRV_INST(n))) = {  \
+        .dev = DEVICE_DT_INST_GET(n),                                                              \
+        .flush = fn,                                                                               \
+    };
+
+/*
+ * State reset. Behaviors that carry state from one event to the next (remainders, filters,
+ * timers, queued taps) register a reset for their instances, so a trace replay or a test can
+ * start from the same state as after boot.
+ */
+typedef void (*zmk_input_behavior_reset_t)(const struct device *dev);
+
+struct zmk_input_behavior_state_api {
+    const struct device *dev;
+    zmk_input_behavior_reset_t reset;
+};
+
+#define ZMK_INPUT_BEHAVIOR_STATE_API_DT_INST_DEFINE(n, fn)                                         \
+    static const STRUCT_SECTION_ITERABLE(                                                          \
+        zmk_input_behavior_state_api, _CONCAT(zmk_input_behavior_state_api_, DT_DRV_INST(n))) = {  \
+        .dev = DEVICE_DT_INST_GET(n),                                                              \
+        .reset = fn,                                                                               \
+    };
+
+static inline void zmk_input_behavior_reset_all(void) {
+    STRUCT_SECTION_FOREACH(zmk_input_behavior_state_api, api) {
+        api->reset(api->dev);
+    }
+}
+
+static inline int32_t *zmk_input_behavior_frame_field(struct zmk_input_behavior_frame *frame,
+                                                      uint16_t code) {
+    switch (code) {
+    case INPUT_REL_X:
+        return &frame->x;
+    case INPUT_REL_Y:
+        return &frame->y;
+    case INPUT_REL_WHEEL:
+        return &frame->wheel;
+    case INPUT_REL_HWHEEL:
+        return &frame->hwheel;
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Streaming speed estimate in counts per second, integer only and O(1) per event. Motion
+ * reported with one timestamp belongs to the interval ending at it, so a report is folded into
+ * the moving average once the next timestamp shows how long that interval was. Events sharing
+ * a timestamp (x and y of one sensor report) are summed first.
+ */
+struct zmk_input_behavior_velocity {
+    uint32_t last_ms;
+    uint32_t interval_ms;
+    uint32_t pending;
+    uint32_t speed;
+};
+
+// Moving average weight of a new interval, 1 / 2^shift.
+#define ZMK_INPUT_BEHAVIOR_VELOCITY_SHIFT 2
+// A gap longer than this is a new gesture, the estimate starts over from zero.
+#define ZMK_INPUT_BEHAVIOR_VELOCITY_IDLE_MS 100
+
+static inline uint32_t zmk_input_behavior_velocity_update(struct zmk_input_behavior_velocity *v,
+                                                          uint32_t distance, uint32_t now_ms) {
+    uint32_t dt = now_ms - v->last_ms;
+    if (dt > ZMK_INPUT_BEHAVIOR_VELOCITY_IDLE_MS) {
+        v->speed = 0;
+        v->interval_ms = 0;
+        v->last_ms = now_ms;
+        v->pending = 0;
+    } else if (dt) {
+        // right after an idle gap the first interval is unknown, assume the report rate held
+        uint32_t interval = v->interval_ms ? v->interval_ms : dt;
+        // interval never exceeds the idle gap, clamping the distance keeps the rate in 32 bits
+        // so cores without a divider only pay for __aeabi_uidiv, not the 64-bit libcall
+        int32_t rate = (int32_t)(MIN(v->pending, INT32_MAX / 1000) * 1000 / interval);
+        int32_t speed = (int32_t)v->speed;
+        v->speed = (uint32_t)(speed + ((rate - speed) >> ZMK_INPUT_BEHAVIOR_VELOCITY_SHIFT));
+        v->interval_ms = dt;
+        v->last_ms = now_ms;
+        v->pending = 0;
+    }
+    v->pending += distance;
+    return v->speed;
+}
+
+/*
+ * Piecewise linear curve through (x, y) pairs sorted by x, flattened as devicetree arrays are.
+ * Values before the first and after the last point are held flat.
+ */
+static inline int32_t zmk_input_behavior_curve_eval(const int32_t *points, size_t len, int32_t x) {
+    if (len < 2) {
+        return 0;
+    }
+    if (x <= points[0]) {
+        return points[1];
+    }
+    for (size_t i = 2; i + 1 < len; i += 2) {
+        int32_t x0 = points[i - 2], y0 = points[i - 1];
+        int32_t x1 = points[i], y1 = points[i + 1];
+        if (x <= x1) {
+            if (x1 == x0) {
+                return y1;
+            }
+            return y0 + (int32_t)((int64_t)(y1 - y0) * (x - x0) / (x1 - x0));
+        }
+    }
+    return points[len - 1];
+}
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_BENCH)
+
+enum zmk_input_behavior_bench_stage {
+    ZMK_INPUT_BEHAVIOR_BENCH_TRANSFORM,
+    ZMK_INPUT_BEHAVIOR_BENCH_BINDING,
+    ZMK_INPUT_BEHAVIOR_BENCH_SYNC,
+};
+
+// Monotonic nanoseconds, the caller picks the clock since cycle counters stand still on native_sim.
+typedef uint64_t (*zmk_input_behavior_bench_clock_t)(void);
+
+struct zmk_input_behavior_bench_run {
+    // listener node name
+    const char *listener;
+    enum zmk_input_behavior_bench_stage stage;
+    // index into the listener bindings, for ZMK_INPUT_BEHAVIOR_BENCH_BINDING
+    uint8_t binding;
+    // circle, flick, jitter or scroll, the "ibl replay gen" shapes
+    const char *shape;
+    uint32_t hz;
+    uint32_t frames;
+    zmk_input_behavior_bench_clock_t clock;
+};
+
+struct zmk_input_behavior_bench_result {
+    // behavior device of the timed binding, NULL for the other stages
+    const char *binding;
+    // events timed, frames for ZMK_INPUT_BEHAVIOR_BENCH_SYNC
+    uint32_t events;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+/*
+ * Times one listener stage on its own over a synthetic trace played on the kernel clock:
+ * transform is intercept_with_input_config() without bindings, binding one binding_pressed()
+ * on the transformed events, sync the rotation and report at the end of each frame. Stages
+ * ahead of the timed one still run, untimed. Like a replay it ignores live input, sends no
+ * reports and resets listener and behavior state before and after. Returns -EINVAL for an
+ * unknown listener or shape and -ENOENT past the last resolved binding.
+ */
+int zmk_input_behavior_bench(const struct zmk_input_behavior_bench_run *run,
+                             struct zmk_input_behavior_bench_result *res);
+
+#endif
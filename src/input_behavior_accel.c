@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_input_behavior_accel
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <drivers/behavior.h>
+#include <zephyr/input/input.h>
+#include <zephyr/dt-bindings/input/input-event-codes.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/keymap.h>
+#include <zmk/behavior.h>
+#include <zmk/input_behavior.h>
+
+#if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+// Gain table entries, each covering one speed step, faster motion uses the last.
+#define ACCEL_LUT_LEN 32
+// Gains are Q8, 256 is 1x.
+#define ACCEL_GAIN_SHIFT 8
+#define ACCEL_GAIN_ONE (1 << ACCEL_GAIN_SHIFT)
+
+#define ACCEL_CODES (INPUT_REL_MISC + 1)
+
+enum accel_curve_idx {
+    ACCEL_CURVE_POINTER,
+    ACCEL_CURVE_SCROLL,
+    ACCEL_CURVE_COUNT,
+};
+
+struct accel_curve {
+    // NULL leaves the motion of this curve alone
+    const uint16_t *lut;
+    uint8_t speed_shift;
+};
+
+struct behavior_accel_config {
+    struct accel_curve curves[ACCEL_CURVE_COUNT];
+};
+
+struct behavior_accel_data {
+    struct zmk_input_behavior_velocity velocity[ACCEL_CURVE_COUNT];
+    // Q8 fractions left over per code, carried into the next event
+    int32_t rem[ACCEL_CODES];
+};
+
+static int accel_curve_for_code(uint16_t code) {
+    switch (code) {
+    case INPUT_REL_X:
+    case INPUT_REL_Y:
+        return ACCEL_CURVE_POINTER;
+    case INPUT_REL_WHEEL:
+    case INPUT_REL_HWHEEL:
+        return ACCEL_CURVE_SCROLL;
+    default:
+        return -1;
+    }
+}
+
+// Applies the gain for the current speed to value, returns false if nothing whole is left yet.
+static bool accel_value(const struct behavior_accel_config *config,
+                        struct behavior_accel_data *data, uint16_t code, int32_t *value,
+                        uint32_t now) {
+    int idx = accel_curve_for_code(code);
+    if (idx < 0 || !config->curves[idx].lut) {
+        return true;
+    }
+    const struct accel_curve *curve = &config->curves[idx];
+
+    uint32_t speed = zmk_input_behavior_velocity_update(&data->velocity[idx],
+                                                        (uint32_t)abs(*value), now);
+    uint16_t gain = curve->lut[MIN(speed >> curve->speed_shift, ACCEL_LUT_LEN - 1)];
+
+    int64_t acc = (int64_t)*value * gain + data->rem[code];
+    int32_t out = (int32_t)CLAMP(acc / ACCEL_GAIN_ONE, INT32_MIN, INT32_MAX);
+    data->rem[code] = (int32_t)(acc - (int64_t)out * ACCEL_GAIN_ONE);
+    *value = out;
+    return out != 0;
+}
+
+static int accel_keymap_binding_pressed(struct zmk_behavior_binding *binding,
+                                        struct zmk_behavior_binding_event event) {
+    const struct device *dev = zmk_input_behavior_binding_dev(binding);
+    struct behavior_accel_data *data = dev->data;
+    const struct behavior_accel_config *config = dev->config;
+
+    struct input_event *evt = (struct input_event *)(uintptr_t)event.position;
+    if (evt->type != INPUT_EV_REL || evt->code >= ACCEL_CODES || !evt->value) {
+        return ZMK_BEHAVIOR_TRANSPARENT;
+    }
+
+    if (!accel_value(config, data, evt->code, &evt->value, (uint32_t)event.timestamp)) {
+        return ZMK_BEHAVIOR_OPAQUE;
+    }
+    return ZMK_BEHAVIOR_TRANSPARENT;
+}
+
+static const uint16_t accel_frame_codes[] = {INPUT_REL_X, INPUT_REL_Y, INPUT_REL_WHEEL,
+                                             INPUT_REL_HWHEEL};
+
+static int accel_frame_process(const struct device *dev, struct zmk_behavior_binding *binding,
+                               struct zmk_input_behavior_frame *frame) {
+    struct behavior_accel_data *data = dev->data;
+    const struct behavior_accel_config *config = dev->config;
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(accel_frame_codes); i++) {
+        int32_t *value = zmk_input_behavior_frame_field(frame, accel_frame_codes[i]);
+        if (*value) {
+            accel_value(config, data, accel_frame_codes[i], value, (uint32_t)frame->timestamp);
+        }
+    }
+    return ZMK_BEHAVIOR_TRANSPARENT;
+}
+
+static void accel_reset(const struct device *dev) {
+    memset(dev->data, 0, sizeof(struct behavior_accel_data));
+}
+
+static const struct behavior_driver_api behavior_accel_driver_api = {
+    .binding_pressed = accel_keymap_binding_pressed,
+};
+
+/*
+ * The gain tables are built by the preprocessor. The devicetree curve is piecewise linear
+ * through (speed, gain %) points, written as a start gain plus one clamped ramp per segment,
+ * and each table entry evaluates that sum at its speed as a constant expression.
+ */
+#define ACCEL_SEG_WIDTH(node_id, speeds, idx)                                                      \
+    (DT_PROP_BY_IDX(node_id, speeds, idx) - DT_PROP_BY_IDX(node_id, speeds, UTIL_DEC(idx)))
+
+#define ACCEL_SEG(node_id, speeds, idx, gains, x)                                                  \
+    +((DT_PROP_BY_IDX(node_id, gains, idx) - DT_PROP_BY_IDX(node_id, gains, UTIL_DEC(idx))) *      \
+      CLAMP((x) - DT_PROP_BY_IDX(node_id, speeds, UTIL_DEC(idx)), 0,                               \
+            ACCEL_SEG_WIDTH(node_id, speeds, idx)) /                                               \
+      MAX(ACCEL_SEG_WIDTH(node_id, speeds, idx), 1))
+
+#define ACCEL_GAIN_PCT(n, speeds, gains, x)                                                        \
+    (DT_INST_PROP_BY_IDX(n, gains, 0)                                                              \
+         DT_INST_FOREACH_PROP_ELEM_VARGS(n, speeds, ACCEL_SEG, gains, x))
+
+#define ACCEL_LUT_ENTRY(i, n, curve)                                                               \
+    (ACCEL_GAIN_PCT(n, curve##_speeds, curve##_gains, (i) * ACCEL_STEP(n, curve)) *                \
+     ACCEL_GAIN_ONE / 100)
+
+#define ACCEL_TOP_SPEED(n, curve)                                                                  \
+    DT_INST_PROP_BY_IDX(n, curve##_speeds, UTIL_DEC(DT_INST_PROP_LEN(n, curve##_speeds)))
+
+/*
+ * Without speed-step each curve gets the smallest power of two step that puts its top speed
+ * within the table, so the last curve point is never cut off.
+ */
+#define ACCEL_SPEED_SHIFT(n, curve)                                                                \
+    COND_CODE_1(DT_INST_NODE_HAS_PROP(n, speed_step), (LOG2CEIL(DT_INST_PROP(n, speed_step))),     \
+                (LOG2CEIL(DIV_ROUND_UP(ACCEL_TOP_SPEED(n, curve), ACCEL_LUT_LEN - 1))))
+
+#define ACCEL_STEP(n, curve) BIT(ACCEL_SPEED_SHIFT(n, curve))
+
+#define ACCEL_LUT_DEFINE(n, curve)                                                                 \
+    COND_CODE_1(DT_INST_NODE_HAS_PROP(n, curve##_speeds),                                          \
+                (BUILD_ASSERT(DT_INST_PROP_LEN(n, curve##_speeds) ==                               \
+                                  DT_INST_PROP_LEN(n, curve##_gains),                              \
+                              "Accel curve needs one gain per speed");                             \
+                 BUILD_ASSERT(ACCEL_TOP_SPEED(n, curve) <=                                         \
+                                  (ACCEL_LUT_LEN - 1) * ACCEL_STEP(n, curve),                      \
+                              "Accel curve's top speed is past the table, raise speed-step");      \
+                 static const uint16_t accel_##curve##_lut_##n[ACCEL_LUT_LEN] = {                  \
+                     LISTIFY(ACCEL_LUT_LEN, ACCEL_LUT_ENTRY, (, ), n, curve)};),                   \
+                ())
+
+#define ACCEL_CURVE(n, curve)                                                                      \
+    {                                                                                              \
+        .lut = COND_CODE_1(DT_INST_NODE_HAS_PROP(n, curve##_speeds), (accel_##curve##_lut_##n),    \
+                           (NULL)),                                                                \
+        .speed_shift = COND_CODE_1(DT_INST_NODE_HAS_PROP(n, curve##_speeds),                       \
+                                   (ACCEL_SPEED_SHIFT(n, curve)), (0)),                            \
+    }
+
+#define ACCEL_INST(n)                                                                              \
+    COND_CODE_1(DT_INST_NODE_HAS_PROP(n, speed_step),                                              \
+                (BUILD_ASSERT(IS_POWER_OF_TWO(DT_INST_PROP(n, speed_step)),                        \
+                              "Accel speed-step must be a power of two");),                        \
+                ())                                                                                \
+    ACCEL_LUT_DEFINE(n, pointer)                                                                   \
+    ACCEL_LUT_DEFINE(n, scroll)                                                                    \
+    static struct behavior_accel_data behavior_accel_data_##n = {};                                \
+    static const struct behavior_accel_config behavior_accel_config_##n = {                        \
+        .curves =                                                                                  \
+            {                                                                                      \
+                [ACCEL_CURVE_POINTER] = ACCEL_CURVE(n, pointer),                                   \
+                [ACCEL_CURVE_SCROLL] = ACCEL_CURVE(n, scroll),                                     \
+            },                                                                                     \
+    };                                                                                             \
+    BEHAVIOR_DT_INST_DEFINE(n, NULL, NULL, &behavior_accel_data_##n, &behavior_accel_config_##n,   \
+                            POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,                      \
+                            &behavior_accel_driver_api);                                           \
+    ZMK_INPUT_BEHAVIOR_FRAME_API_DT_INST_DEFINE(n, accel_frame_process)                            \
+    ZMK_INPUT_BEHAVIOR_STATE_API_DT_INST_DEFINE(n, accel_reset)
+
+DT_INST_FOREACH_STATUS_OKAY(ACCEL_INST)
+
+#endif /* DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT) */
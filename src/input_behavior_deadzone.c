@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_input_behavior_deadzone
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <drivers/behavior.h>
+#include <zephyr/input/input.h>
+#include <zephyr/dt-bindings/input/input-event-codes.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/keymap.h>
+#include <zmk/behavior.h>
+#include <zmk/input_behavior.h>
+
+#if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+#define DEADZONE_CODES (INPUT_REL_MISC + 1)
+
+struct behavior_deadzone_config {
+    uint16_t threshold;
+    uint16_t window_ms;
+};
+
+/*
+ * A resting sensor dithers around zero. Its deltas go into signed per-code accumulators that
+ * leak by half every window-ms, so back and forth noise cancels and slow drift drains away.
+ * Once an accumulator reaches threshold the motion is real: it goes out right away together
+ * with what was held back, and everything passes untouched until input pauses for window-ms.
+ * Moving is a state of the device, so the other axes give up what they held back as well, a
+ * diagonal stroke does not lose the start of its slower axis.
+ */
+struct behavior_deadzone_data {
+    int32_t acc[DEADZONE_CODES];
+    uint32_t last_leak_ms;
+    uint32_t last_pass_ms;
+    bool moving;
+};
+
+static void deadzone_leak(const struct behavior_deadzone_config *config,
+                          struct behavior_deadzone_data *data, uint32_t now) {
+    uint32_t elapsed = now - data->last_leak_ms;
+    if (elapsed < config->window_ms) {
+        return;
+    }
+    uint32_t halvings = MIN(elapsed / config->window_ms, 30);
+    for (uint8_t i = 0; i < DEADZONE_CODES; i++) {
+        // divide rather than shift so negative noise leaks toward zero as well
+        data->acc[i] /= (1 << halvings);
+    }
+    data->last_leak_ms = now;
+}
+
+// Returns false if value was absorbed as noise.
+static bool deadzone_value(const struct behavior_deadzone_config *config,
+                           struct behavior_deadzone_data *data, uint16_t code, int32_t *value,
+                           uint32_t now) {
+    if (data->moving && now - data->last_pass_ms < config->window_ms) {
+        // held back before another axis started the motion, goes out with this axis' next event
+        *value += data->acc[code];
+        data->acc[code] = 0;
+        data->last_pass_ms = now;
+        return true;
+    }
+    data->moving = false;
+
+    deadzone_leak(config, data, now);
+    data->acc[code] += *value;
+    if ((uint32_t)abs(data->acc[code]) < config->threshold) {
+        *value = 0;
+        return false;
+    }
+
+    *value = data->acc[code];
+    data->acc[code] = 0;
+    data->moving = true;
+    data->last_pass_ms = now;
+    return true;
+}
+
+static int deadzone_keymap_binding_pressed(struct zmk_behavior_binding *binding,
+                                           struct zmk_behavior_binding_event event) {
+    const struct device *dev = zmk_input_behavior_binding_dev(binding);
+    struct behavior_deadzone_data *data = dev->data;
+    const struct behavior_deadzone_config *config = dev->config;
+
+    struct input_event *evt = (struct input_event *)(uintptr_t)event.position;
+    if (evt->type != INPUT_EV_REL || evt->code >= DEADZONE_CODES || !evt->value) {
+        return ZMK_BEHAVIOR_TRANSPARENT;
+    }
+
+    if (!deadzone_value(config, data, evt->code, &evt->value, (uint32_t)event.timestamp)) {
+        return ZMK_BEHAVIOR_OPAQUE;
+    }
+    return ZMK_BEHAVIOR_TRANSPARENT;
+}
+
+static const uint16_t deadzone_frame_codes[] = {INPUT_REL_X, INPUT_REL_Y, INPUT_REL_WHEEL,
+                                                INPUT_REL_HWHEEL};
+
+static int deadzone_frame_process(const struct device *dev, struct zmk_behavior_binding *binding,
+                                  struct zmk_input_behavior_frame *frame) {
+    struct behavior_deadzone_data *data = dev->data;
+    const struct behavior_deadzone_config *config = dev->config;
+
+    bool absorbed = false;
+    bool passed = false;
+    for (uint8_t i = 0; i < ARRAY_SIZE(deadzone_frame_codes); i++) {
+        int32_t *value = zmk_input_behavior_frame_field(frame, deadzone_frame_codes[i]);
+        if (!*value) {
+            continue;
+        }
+        if (deadzone_value(config, data, deadzone_frame_codes[i], value,
+                           (uint32_t)frame->timestamp)) {
+            passed = true;
+        } else {
+            absorbed = true;
+        }
+    }
+
+    // what the other axes held back, this frame included, is part of the motion that started
+    if (passed) {
+        for (uint8_t i = 0; i < ARRAY_SIZE(deadzone_frame_codes); i++) {
+            uint16_t code = deadzone_frame_codes[i];
+            *zmk_input_behavior_frame_field(frame, code) += data->acc[code];
+            data->acc[code] = 0;
+        }
+    }
+
+    // a frame of nothing but noise stops here, so later bindings do not see it as activity
+    if (absorbed && !passed && !frame->button_set && !frame->button_clear) {
+        return ZMK_BEHAVIOR_OPAQUE;
+    }
+    return ZMK_BEHAVIOR_TRANSPARENT;
+}
+
+static void deadzone_reset(const struct device *dev) {
+    memset(dev->data, 0, sizeof(struct behavior_deadzone_data));
+}
+
+static const struct behavior_driver_api behavior_deadzone_driver_api = {
+    .binding_pressed = deadzone_keymap_binding_pressed,
+};
+
+#define DEADZONE_INST(n)                                                                           \
+    static struct behavior_deadzone_data behavior_deadzone_data_##n = {};                          \
+    static const struct behavior_deadzone_config behavior_deadzone_config_##n = {                  \
+        .threshold = DT_INST_PROP(n, threshold),                                                   \
+        .window_ms = MAX(DT_INST_PROP(n, window_ms), 1),                                           \
+    };                                                                                             \
+    BEHAVIOR_DT_INST_DEFINE(n, NULL, NULL, &behavior_deadzone_data_##n,                            \
+                            &behavior_deadzone_config_##n, POST_KERNEL,                            \
+                            CONFIG_KERNEL_INIT_PRIORITY_DEFAULT, &behavior_deadzone_driver_api);   \
+    ZMK_INPUT_BEHAVIOR_FRAME_API_DT_INST_DEFINE(n, deadzone_frame_process)                         \
+    ZMK_INPUT_BEHAVIOR_STATE_API_DT_INST_DEFINE(n, deadzone_reset)
+
+DT_INST_FOREACH_STATUS_OKAY(DEADZONE_INST)
+
+#endif /* DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT) */
@@ -23,16 +23,42 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #include <zmk/behavior.h>
 #include <zmk/event_manager.h>
 #include <zmk/events/layer_state_changed.h>
+#include <zmk/input_behavior.h>
 
 #ifndef ZMK_MOUSE_HID_NUM_BUTTONS
 #define ZMK_MOUSE_HID_NUM_BUTTONS 0x05
 #endif
 
-#include <math.h>
-#ifndef M_PI
-#define M_PI (3.14159265358979323846f)
-#endif
 #include <zephyr/sys/util.h> // for CLAMP
+#include <zephyr/sys/math_extras.h>
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+#include <zephyr/stats/stats.h>
+#endif
+
+// Any of the runtime diagnostics, these name their listeners and share the ibl shell command.
+#define IBL_DIAG                                                                                   \
+    (IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS) ||                                       \
+     IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY) ||                                     \
+     IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE) ||                                     \
+     IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPLAY))
+#define IBL_SHELL (IBL_DIAG && IS_ENABLED(CONFIG_SHELL))
+
+#if IBL_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE)
+#include <string.h>
+#include <zephyr/sys/base64.h>
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPLAY)
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/sys/crc.h>
+#include <zmk/events/keycode_state_changed.h>
+#endif
 
 #define ONE_IF_DEV_OK(n)                                                                           \
     COND_CODE_1(DT_NODE_HAS_STATUS(DT_INST_PHANDLE(n, device), okay), (1 +), (0 +))
@@ -44,42 +70,229 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 enum input_behavior_listener_xy_data_mode {
     INPUT_LISTENER_XY_DATA_MODE_NONE,
     INPUT_LISTENER_XY_DATA_MODE_REL,
-    INPUT_LISTENER_XY_DATA_MODE_ABS,
 };
 
 struct input_behavior_listener_xy_data {
     enum input_behavior_listener_xy_data_mode mode;
-    int16_t x;
-    int16_t y;
+    int32_t x;
+    int32_t y;
+    // Q15 fractions left over from rotation, carried into the next report
+    int32_t x_rem;
+    int32_t y_rem;
+};
+
+// Listener-local mouse report, built across syncs and diffed against the last one sent.
+struct input_behavior_listener_report {
+    int32_t x;
+    int32_t y;
+    int32_t scroll_x;
+    int32_t scroll_y;
+    uint8_t buttons;
+};
+
+// Largest deltas a single HID mouse report can carry, anything beyond is sent in the next one.
+#define IBL_REPORT_MOVE_MAX INT16_MAX
+#define IBL_REPORT_SCROLL_MAX INT8_MAX
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+
+STATS_SECT_START(ibl)
+STATS_SECT_ENTRY32(events)
+STATS_SECT_ENTRY32(rejected)
+STATS_SECT_ENTRY32(opaque)
+STATS_SECT_ENTRY32(reports)
+STATS_SECT_END;
+
+STATS_NAME_START(ibl)
+STATS_NAME(ibl, events)
+STATS_NAME(ibl, rejected)
+STATS_NAME(ibl, opaque)
+STATS_NAME(ibl, reports)
+STATS_NAME_END(ibl);
+
+/*
+ * Each listener is only ever run from one context, so the counters are written by a single
+ * thread and the atomics are there for the shell reading them from another one.
+ */
+struct input_behavior_listener_stats {
+    atomic_t events;
+    atomic_t rejected;
+    atomic_t opaque;
+    atomic_t reports;
+    atomic_t cycles_max;
+    // moving average over the last ~16 events
+    atomic_t cycles_avg;
+#if IS_ENABLED(CONFIG_STATS)
+    STATS_SECT_DECL(ibl) group;
+#endif
+};
+
+#if IS_ENABLED(CONFIG_STATS)
+#define IBL_STATS_MIRROR(data, field) STATS_INC((data)->stats.group, field)
+#else
+#define IBL_STATS_MIRROR(data, field)
+#endif
+
+#define IBL_STATS_INC(data, field)                                                                 \
+    do {                                                                                           \
+        atomic_inc(&(data)->stats.field);                                                          \
+        IBL_STATS_MIRROR(data, field);                                                             \
+    } while (0)
+
+static void stats_handler_cycles(struct input_behavior_listener_stats *stats, uint32_t cycles) {
+    if (cycles > (uint32_t)atomic_get(&stats->cycles_max)) {
+        atomic_set(&stats->cycles_max, cycles);
+    }
+    atomic_val_t avg = atomic_get(&stats->cycles_avg);
+    atomic_set(&stats->cycles_avg, avg + (((int32_t)cycles - (int32_t)avg) >> 4));
+}
+
+#else
+
+#define IBL_STATS_INC(data, field)
+
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+
+/*
+ * Input to report latency, from the input callback to the mouse report going out. Bucket 0
+ * holds samples below 1 us, bucket i those in [2^(i-1), 2^i) us and the last one the rest.
+ */
+#define IBL_LATENCY_BUCKETS 20
+
+struct input_behavior_listener_latency {
+    atomic_t buckets[IBL_LATENCY_BUCKETS];
+    atomic_t max_us;
 };
 
+// Cycle stamp of an event entering the listener, 0 means not stamped.
+#define IBL_LATENCY_STAMP() (k_cycle_get_32() | 1)
+
+static void latency_record(struct input_behavior_listener_latency *latency, uint32_t start) {
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    uint8_t bucket = MIN(32 - u32_count_leading_zeros(us), IBL_LATENCY_BUCKETS - 1);
+    atomic_inc(&latency->buckets[bucket]);
+    if (us > (uint32_t)atomic_get(&latency->max_us)) {
+        atomic_set(&latency->max_us, us);
+    }
+}
+
+#else
+
+#define IBL_LATENCY_STAMP() 0
+
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPLAY)
+
+/*
+ * Trace replay from the shell, see cmd_ibl_replay. While it runs, live input is ignored, the
+ * trace is played at its own pace on the kernel clock and reports go into a CRC instead of to
+ * the host, followed by one over the key events bindings raised. Listeners and behaviors are reset before and after, so with a simulated clock
+ * (native_sim) the same trace gives the same report stream on every run.
+ */
+static struct {
+    // live input is dropped from the moment a replay is started
+    atomic_t blocked;
+    atomic_t active;
+    uint32_t reports;
+    uint32_t crc;
+    // key events raised by bindings, from their own work items, folded into crc at the end
+    uint32_t key_crc;
+    atomic_t keypresses;
+} replay;
+
+#endif
+
+struct input_behavior_listener_route;
+
 struct input_behavior_listener_data {
+    // route of the listener's device, set once at init
+    struct input_behavior_listener_route *route;
+    // some binding holds motion back, idle_work flushes it once input stops
+    bool has_flush;
+    struct k_work_delayable idle_work;
+    atomic_t idle_armed;
+    atomic_t last_activity;
     union {
         struct {
-            float sin;
-            float cos;
-
             struct input_behavior_listener_xy_data data;
             struct input_behavior_listener_xy_data wheel_data;
 
             uint8_t button_set;
             uint8_t button_clear;
+
+            struct k_spinlock lock;
+            struct input_behavior_listener_report pending;
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_PACING)
+            struct k_work_delayable flush_work;
+            uint32_t last_flush;
+#endif
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+            // stamp of the first event of the frame being collected
+            uint32_t frame_start;
+            // stamp of the oldest frame in pending, guarded by lock
+            uint32_t report_start;
+#endif
         } mouse;
     };
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+    struct input_behavior_listener_stats stats;
+#endif
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+    struct input_behavior_listener_latency latency;
+#endif
+};
+
+BUILD_ASSERT(ZMK_KEYMAP_LAYERS_LEN <= 32, "Listener layer masks are limited to 32 layers");
+BUILD_ASSERT(VALID_LISTENER_COUNT <= 32, "Listener dispatch masks are limited to 32 listeners");
+
+// Highest active layer, kept up to date by the layer_state_changed subscription below.
+static uint8_t active_layer;
+// Bumped on every layer change, lets the dispatcher notice one made by a binding mid-event.
+static atomic_t layer_generation;
+// Thread that made the last layer change, changes made by other threads are not followed.
+static atomic_ptr_t layer_changed_by;
+
+// Layer changes a single event may go through before the dispatcher stops following them.
+#define IBL_MAX_LAYER_HOPS 4
+
+struct input_behavior_listener_binding {
+    const struct device *dev;
+    const struct behavior_driver_api *api;
+    zmk_input_behavior_frame_process_t frame;
+    zmk_input_behavior_flush_t flush;
 };
 
+struct input_behavior_listener_config;
+
+// Returns true when a binding swallowed the event, so it reached no report.
+typedef bool (*input_behavior_listener_handler_t)(
+    const struct input_behavior_listener_config *config, struct input_behavior_listener_data *data,
+    struct input_event *evt);
+
 struct input_behavior_listener_config {
+    const struct device *dev;
+#if IBL_DIAG
+    const char *name;
+#endif
+    struct input_behavior_listener_data *data;
+    input_behavior_listener_handler_t handler;
+    struct input_behavior_listener_binding *resolved;
     bool xy_swap;
     bool x_invert;
     bool y_invert;
+    bool frame_mode;
     uint16_t scale_multiplier;
     uint16_t scale_divisor;
     uint16_t rotate_deg;
+    int32_t rotate_sin;
+    int32_t rotate_cos;
     int8_t evt_type;
     int8_t x_input_code;
     int8_t y_input_code;
-    uint8_t layers_count;
-    uint8_t layers[ZMK_KEYMAP_LAYERS_LEN];
+    uint32_t layers;
     uint8_t bindings_count;
     struct zmk_behavior_binding bindings[];
 };
@@ -108,9 +321,6 @@ static void handle_rel_code(const struct input_behavior_listener_config *config,
     }
 }
 
-static void handle_abs_code(const struct input_behavior_listener_config *config,
-                            struct input_behavior_listener_data *data, struct input_event *evt) {}
-
 static void handle_key_code(const struct input_behavior_listener_config *config,
                             struct input_behavior_listener_data *data, struct input_event *evt) {
     int8_t btn;
@@ -158,118 +368,288 @@ static inline bool is_y_data(const struct input_event *evt) {
     return evt->type == INPUT_EV_REL && (evt->code == INPUT_REL_Y || evt->code == INPUT_REL_WHEEL);
 }
 
-static bool intercept_with_input_config(const struct input_behavior_listener_config *cfg,
-                                        struct input_event *evt) {
-    if (!evt->dev) {
-        return false;
+/*
+ * Listener transforms are devicetree constants. Handlers are expanded per instance with those
+ * constants passed as literals, so unused transforms, the scale divide and the rotation fold
+ * away and a pass-through listener is left with a plain accumulate-and-report path.
+ */
+#define IBL_SPEC_PARAMS                                                                            \
+    const int8_t evt_type, const int8_t x_input_code, const int8_t y_input_code,                   \
+        const bool xy_swap, const bool x_invert, const bool y_invert,                              \
+        const uint16_t scale_multiplier, const uint16_t scale_divisor, const uint16_t rotate_deg,  \
+        const int32_t rotate_sin, const int32_t rotate_cos, const bool frame_mode
+
+#define IBL_SPEC_ARGS                                                                              \
+    evt_type, x_input_code, y_input_code, xy_swap, x_invert, y_invert, scale_multiplier,           \
+        scale_divisor, rotate_deg, rotate_sin, rotate_cos, frame_mode
+
+#define IBL_SPEC_CFG_ARGS(cfg)                                                                     \
+    (cfg)->evt_type, (cfg)->x_input_code, (cfg)->y_input_code, (cfg)->xy_swap, (cfg)->x_invert,    \
+        (cfg)->y_invert, (cfg)->scale_multiplier, (cfg)->scale_divisor, (cfg)->rotate_deg,         \
+        (cfg)->rotate_sin, (cfg)->rotate_cos, (cfg)->frame_mode
+
+static int invoke_input_behavior(const struct input_behavior_listener_config *cfg, uint8_t b,
+                                 const struct behavior_driver_api *api, struct input_event *evt,
+                                 uint8_t layer) {
+    // input behaviors find their device next to the binding, see zmk_input_behavior_binding_dev()
+    struct zmk_input_behavior_binding input_binding = {
+        .binding = cfg->bindings[b],
+        .dev = cfg->resolved[b].dev,
+    };
+    struct zmk_behavior_binding *binding = &input_binding.binding;
+    int ret = ZMK_BEHAVIOR_TRANSPARENT;
+
+    if (api->binding_pressed || api->binding_released) {
+
+        struct zmk_behavior_binding_event event = {
+            .layer = layer, .timestamp = k_uptime_get(),
+            .position = (uintptr_t)evt, // util uint32_t to pass event ptr :)
+        };
+
+        bool state = true;
+        if (evt->type == INPUT_EV_KEY) {
+            if (evt->code >= INPUT_BTN_0 && evt->code <= INPUT_BTN_8) {
+                state = (evt->value > 0);
+            }
+        }
+
+        if (api->binding_pressed && state) {
+            ret = api->binding_pressed(binding, event);
+        }
+        else if (api->binding_released && !state) {
+            ret = api->binding_released(binding, event);
+        }
+
+    }
+    else if (api->sensor_binding_process) {
+
+        struct zmk_behavior_binding_event event = {
+            .layer = layer, .timestamp = k_uptime_get(),
+            .position = 0,
+        };
+        if (api->sensor_binding_accept_data) {
+            const struct zmk_sensor_config *sensor_config = 
+                (const struct zmk_sensor_config *)cfg;
+            const struct zmk_sensor_channel_data val[] = {
+                { .value = { .val1 = (int32_t)(uintptr_t)evt },
+                .channel = SENSOR_CHAN_ALL, },
+            };
+            int ret = behavior_sensor_keymap_binding_accept_data(
+                binding, event, sensor_config, sizeof(val), val);
+            if (ret < 0) {
+                LOG_WRN("behavior data accept for behavior %s returned an error (%d). "
+                        "Processing to continue to next layer",  binding->behavior_dev, ret);
+            }
+        }
+        enum behavior_sensor_binding_process_mode mode =
+                BEHAVIOR_SENSOR_BINDING_PROCESS_MODE_TRIGGER;
+        ret = behavior_sensor_keymap_binding_process(binding, event, mode);
+
     }
 
-    uint8_t layer = zmk_keymap_highest_layer_active();
-    bool active_layer_check = false;
-    for (uint8_t i = 0; i < cfg->layers_count && !active_layer_check; i++) {
-        active_layer_check |= layer == cfg->layers[i];
+    return ret;
+}
+
+static bool run_input_behaviors(const struct input_behavior_listener_config *cfg,
+                                struct input_event *evt) {
+    // layer gating already happened in the device dispatcher
+    uint8_t layer = active_layer;
+
+    bool to_be_intercapted = true;
+
+    for (uint8_t b = 0; b < cfg->bindings_count; b++) {
+        const struct behavior_driver_api *api = cfg->resolved[b].api;
+        if (!api) {
+            // unresolvable bindings are reported once at init
+            continue;
+        }
+
+        int ret = invoke_input_behavior(cfg, b, api, evt, layer);
+        if (ret == ZMK_BEHAVIOR_OPAQUE) {
+            // LOG_DBG("input event processing complete, behavior response was opaque");
+            IBL_STATS_INC(cfg->data, opaque);
+            to_be_intercapted = false;
+            break;
+        } else if (ret < 0) {
+            // LOG_DBG("input behavior returned error: %d", ret);
+            return ret;
+        }
     }
-    if (!active_layer_check) {
+
+    return to_be_intercapted;
+}
+
+static ALWAYS_INLINE bool
+intercept_with_input_config(const struct input_behavior_listener_config *cfg,
+                            struct input_event *evt, IBL_SPEC_PARAMS) {
+    if (!evt->dev) {
         return false;
     }
 
-    if (cfg->evt_type >= 0 && evt->type == cfg->evt_type) {
+    if (evt_type >= 0 && evt->type == evt_type) {
         if ((evt->code == INPUT_REL_X) || (evt->code == INPUT_REL_HWHEEL)) {
-            if (cfg->x_input_code >= 0) {
-                evt->code = cfg->x_input_code;
+            if (x_input_code >= 0) {
+                evt->code = x_input_code;
             }
         }
         else if ((evt->code == INPUT_REL_Y) || (evt->code == INPUT_REL_WHEEL)) {
-            if (cfg->y_input_code >= 0) {
-                evt->code = cfg->y_input_code;
+            if (y_input_code >= 0) {
+                evt->code = y_input_code;
             }
         }
     }
 
-    if (cfg->xy_swap) {
+    if (xy_swap) {
         swap_xy(evt);
     }
 
-    if ((cfg->x_invert && is_x_data(evt)) || (cfg->y_invert && is_y_data(evt))) {
+    if ((x_invert && is_x_data(evt)) || (y_invert && is_y_data(evt))) {
         evt->value = -(evt->value);
     }
 
-    evt->value = (int16_t)((evt->value * cfg->scale_multiplier) / cfg->scale_divisor);
+    if (scale_multiplier != scale_divisor) {
+        evt->value = (int32_t)(((int64_t)evt->value * scale_multiplier) / scale_divisor);
+    }
 
-    bool to_be_intercapted = true;
+    // frame mode bindings run once per sync, see run_frame_behaviors
+    if (!cfg->bindings_count || frame_mode) {
+        return true;
+    }
+    return run_input_behaviors(cfg, evt);
+}
 
-    for (uint8_t b = 0; b < cfg->bindings_count; b++) {
-        struct zmk_behavior_binding binding = cfg->bindings[b];
-        // LOG_DBG("layer: %d input: %s, binding name: %s", layer, evt->dev->name, binding.behavior_dev);
+static const uint16_t frame_rel_codes[] = {INPUT_REL_X, INPUT_REL_Y, INPUT_REL_WHEEL,
+                                           INPUT_REL_HWHEEL};
+
+/*
+ * Feeds a frame to a binding without a frame handler as the per-event calls it expects, returns
+ * true if any of them was opaque.
+ */
+static bool replay_frame_events(const struct input_behavior_listener_config *cfg, uint8_t b,
+                                const struct behavior_driver_api *api,
+                                struct zmk_input_behavior_frame *frame) {
+    struct input_event evt = {.dev = cfg->dev, .type = INPUT_EV_REL};
+    bool opaque = false;
 
-        const struct device *behavior = zmk_behavior_get_binding(binding.behavior_dev);
-        if (!behavior) {
-            LOG_WRN("No behavior assigned to %s on layer %d", evt->dev->name, layer);
+    for (uint8_t i = 0; i < ARRAY_SIZE(frame_rel_codes); i++) {
+        int32_t *value = zmk_input_behavior_frame_field(frame, frame_rel_codes[i]);
+        if (!*value) {
             continue;
         }
+        evt.code = frame_rel_codes[i];
+        evt.value = *value;
+        int ret = invoke_input_behavior(cfg, b, api, &evt, frame->layer);
+        opaque |= (ret == ZMK_BEHAVIOR_OPAQUE);
+        *value = (ret == ZMK_BEHAVIOR_OPAQUE) ? 0 : evt.value;
+    }
 
-        const struct behavior_driver_api *api = (const struct behavior_driver_api *)behavior->api;
-        int ret = ZMK_BEHAVIOR_TRANSPARENT;
-
-        if (api->binding_pressed || api->binding_released) {
-
-            struct zmk_behavior_binding_event event = {
-                .layer = layer, .timestamp = k_uptime_get(),
-                .position = (struct input_event *)evt, // util uint32_t to pass event ptr :)
-            };
-
-            bool state = true;
-            if (evt->type == INPUT_EV_KEY) {
-                if (evt->code >= INPUT_BTN_0 && evt->code <= INPUT_BTN_8) {
-                    state = (evt->value > 0);
-                }
-            }
+    evt.type = INPUT_EV_KEY;
+    for (uint8_t i = 0; i < ZMK_MOUSE_HID_NUM_BUTTONS; i++) {
+        uint8_t *buttons = (frame->button_set & BIT(i))     ? &frame->button_set
+                           : (frame->button_clear & BIT(i)) ? &frame->button_clear
+                                                            : NULL;
+        if (!buttons) {
+            continue;
+        }
+        evt.code = INPUT_BTN_0 + i;
+        evt.value = (buttons == &frame->button_set);
+        if (invoke_input_behavior(cfg, b, api, &evt, frame->layer) == ZMK_BEHAVIOR_OPAQUE) {
+            opaque = true;
+            WRITE_BIT(*buttons, i, 0);
+        }
+    }
+    return opaque;
+}
 
-            if (api->binding_pressed && state) {
-                ret = api->binding_pressed(&binding, event);
-            }
-            else if (api->binding_released && !state) {
-                ret = api->binding_released(&binding, event);
-            }
+/*
+ * Runs the bindings of a frame mode listener over everything collected since the last sync.
+ * Frame handlers edit the frame in place, an opaque result from one drops the whole frame. So
+ * does an opaque event from a binding that switched layers on the way (tog-layer with
+ * sync-activation): the frame belongs to the new layer's listeners then, and true tells the
+ * dispatcher to hand it over.
+ */
+static bool run_frame_behaviors(const struct input_behavior_listener_config *cfg,
+                                struct input_behavior_listener_data *data) {
+    struct zmk_input_behavior_frame frame = {
+        .x = data->mouse.data.x,
+        .y = data->mouse.data.y,
+        .wheel = data->mouse.wheel_data.y,
+        .hwheel = data->mouse.wheel_data.x,
+        .button_set = data->mouse.button_set,
+        .button_clear = data->mouse.button_clear,
+        .layer = active_layer,
+        .timestamp = k_uptime_get(),
+    };
+    atomic_val_t generation = atomic_get(&layer_generation);
+    bool handed_over = false;
 
+    for (uint8_t b = 0; b < cfg->bindings_count; b++) {
+        const struct input_behavior_listener_binding *resolved = &cfg->resolved[b];
+        if (!resolved->api) {
+            continue;
         }
-        else if (api->sensor_binding_process) {
 
-            struct zmk_behavior_binding_event event = {
-                .layer = layer, .timestamp = k_uptime_get(),
-                .position = 0,
-            };
-            if (api->sensor_binding_accept_data) {
-                const struct zmk_sensor_config *sensor_config = 
-                    (const struct zmk_sensor_config *)cfg;
-                const struct zmk_sensor_channel_data val[] = {
-                    { .value = { .val1 = (struct input_event *)evt },
-                    .channel = SENSOR_CHAN_ALL, },
-                };
-                int ret = behavior_sensor_keymap_binding_accept_data(
-                    &binding, event, sensor_config, sizeof(val), val);
-                if (ret < 0) {
-                    LOG_WRN("behavior data accept for behavior %s returned an error (%d). "
-                            "Processing to continue to next layer",  binding.behavior_dev, ret);
-                }
+        if (!resolved->frame) {
+            if (replay_frame_events(cfg, b, resolved->api, &frame) &&
+                atomic_get(&layer_generation) != generation &&
+                atomic_ptr_get(&layer_changed_by) == (atomic_ptr_val_t)k_current_get()) {
+                IBL_STATS_INC(data, opaque);
+                frame = (struct zmk_input_behavior_frame){0};
+                handed_over = true;
+                break;
             }
-            enum behavior_sensor_binding_process_mode mode =
-                    BEHAVIOR_SENSOR_BINDING_PROCESS_MODE_TRIGGER;
-            ret = behavior_sensor_keymap_binding_process(&binding, event, mode);
-
+            continue;
         }
 
-        if (ret == ZMK_BEHAVIOR_OPAQUE) {
-            // LOG_DBG("input event processing complete, behavior response was opaque");
-            to_be_intercapted = false;
+        struct zmk_behavior_binding binding = cfg->bindings[b];
+        if (resolved->frame(resolved->dev, &binding, &frame) == ZMK_BEHAVIOR_OPAQUE) {
+            IBL_STATS_INC(data, opaque);
+            frame = (struct zmk_input_behavior_frame){0};
+            handed_over = atomic_get(&layer_generation) != generation &&
+                          atomic_ptr_get(&layer_changed_by) == (atomic_ptr_val_t)k_current_get();
             break;
-        } else if (ret < 0) {
-            // LOG_DBG("input behavior returned error: %d", ret);
-            return ret;
         }
     }
 
-    return to_be_intercapted;
+    data->mouse.data.x = frame.x;
+    data->mouse.data.y = frame.y;
+    data->mouse.wheel_data.y = frame.wheel;
+    data->mouse.wheel_data.x = frame.hwheel;
+    data->mouse.button_set = frame.button_set;
+    data->mouse.button_clear = frame.button_clear;
+    return handed_over;
+}
+
+/*
+ * Rotation coefficients are Q15 fixed point, evaluated by the compiler from rotate-deg with a
+ * 9th order sine polynomial over [-90, 90] degrees (error well below one Q15 step), so neither
+ * the build nor the hot path needs libm or an FPU.
+ */
+#define IBL_Q15_ONE (1 << 15)
+#define IBL_RAD(deg) ((deg) * 3.14159265358979323846 / 180.0)
+#define IBL_SIN_POLY(x)                                                                            \
+    ((x) * (1.0 - (x) * (x) / 6.0 *                                                                \
+                      (1.0 - (x) * (x) / 20.0 *                                                    \
+                                 (1.0 - (x) * (x) / 42.0 * (1.0 - (x) * (x) / 72.0)))))
+#define IBL_SIN_DEG_NORM(d)                                                                        \
+    ((d) <= 90    ? IBL_SIN_POLY(IBL_RAD(d))                                                       \
+     : (d) <= 270 ? IBL_SIN_POLY(IBL_RAD(180 - (d)))                                               \
+                  : IBL_SIN_POLY(IBL_RAD((d) - 360)))
+#define IBL_Q15(v) ((int32_t)((v) * IBL_Q15_ONE + ((v) < 0 ? -0.5 : 0.5)))
+#define IBL_SIN_Q15(deg) IBL_Q15(IBL_SIN_DEG_NORM((deg) % 360))
+#define IBL_COS_Q15(deg) IBL_Q15(IBL_SIN_DEG_NORM(((deg) + 90) % 360))
+
+static inline void rotate_xy_data(struct input_behavior_listener_xy_data *data, int32_t sin,
+                                  int32_t cos) {
+    int64_t x = data->x;
+    int64_t y = data->y;
+    // floor through the carried remainder, so sub-unit motion adds up instead of truncating
+    int64_t rx = (cos * x) - (sin * y) + data->x_rem;
+    int64_t ry = (sin * x) + (cos * y) + data->y_rem;
+    data->x = (int32_t)(rx >> 15);
+    data->y = (int32_t)(ry >> 15);
+    data->x_rem = rx & (IBL_Q15_ONE - 1);
+    data->y_rem = ry & (IBL_Q15_ONE - 1);
 }
 
 static void clear_xy_data(struct input_behavior_listener_xy_data *data) {
@@ -277,131 +657,1863 @@ static void clear_xy_data(struct input_behavior_listener_xy_data *data) {
     data->mode = INPUT_LISTENER_XY_DATA_MODE_NONE;
 }
 
-static void input_behavior_handler(const struct input_behavior_listener_config *config,
-                                   struct input_behavior_listener_data *data, 
-                                   struct input_event *evt) {
-    // First, filter to update the event data as needed.
-    if (!intercept_with_input_config(config, evt)) {
+/*
+ * The HID mouse has one set of buttons for every listener. A button pressed through one listener
+ * is released through another one once the layer changes in between, so the state is tracked
+ * here rather than per listener, or the release would find nothing to release.
+ *
+ * Every change is queued as its own state and each report takes one, so a press and release
+ * that land before the next report (paced, or within one frame) still reach the host as a
+ * click instead of folding into no change at all. Motion made before a change is queued along
+ * with it and goes out first, in the state it was made in, so it never turns into a drag.
+ */
+#define IBL_BUTTON_QUEUE_LEN 8
+
+static struct {
+    struct k_spinlock lock;
+    // state after every frame queued so far
+    uint8_t state;
+    // state the host was last sent
+    uint8_t sent;
+    // states not reported yet, oldest first, each with the motion made before it
+    struct input_behavior_listener_report queue[IBL_BUTTON_QUEUE_LEN];
+    uint8_t queue_head;
+    uint8_t queue_len;
+} mouse_buttons;
+
+static inline bool report_has_motion(const struct input_behavior_listener_report *report) {
+    return report->x || report->y || report->scroll_x || report->scroll_y;
+}
+
+/*
+ * Queues a new button state behind the motion pending so far, which moves into the queue
+ * with it. Called with mouse_buttons.lock and the pending report's lock held.
+ */
+static void mouse_buttons_push(uint8_t state, struct input_behavior_listener_report *pending) {
+    if (state == mouse_buttons.state) {
         return;
     }
-
-    switch (evt->type) {
-    case INPUT_EV_REL:
-        handle_rel_code(config, data, evt);
-        break;
-    case INPUT_EV_ABS:
-        handle_abs_code(config, data, evt);
-        break;
-    case INPUT_EV_KEY:
-        handle_key_code(config, data, evt);
-        break;
+    mouse_buttons.state = state;
+    uint8_t idx = (mouse_buttons.queue_head + mouse_buttons.queue_len) % IBL_BUTTON_QUEUE_LEN;
+    if (mouse_buttons.queue_len == IBL_BUTTON_QUEUE_LEN) {
+        // more edges than reports can keep up with, the newest state replaces the last one
+        idx = (idx + IBL_BUTTON_QUEUE_LEN - 1) % IBL_BUTTON_QUEUE_LEN;
+    } else {
+        mouse_buttons.queue[idx] = (struct input_behavior_listener_report){0};
+        mouse_buttons.queue_len++;
     }
 
-    if (evt->sync) {
-        if (data->mouse.wheel_data.mode == INPUT_LISTENER_XY_DATA_MODE_REL) {
-            if (config->rotate_deg > 0) {
-                float x = data->mouse.wheel_data.x;
-                float y = data->mouse.wheel_data.y;
-                data->mouse.wheel_data.x = (data->mouse.cos * x) - (data->mouse.sin * y);
-                data->mouse.wheel_data.y = (data->mouse.sin * x) + (data->mouse.cos * y);
-            }
-            #if IS_ENABLED(CONFIG_ZMK_MOUSE)
-                zmk_hid_mouse_scroll_set(data->mouse.wheel_data.x, data->mouse.wheel_data.y);
-            #endif
-        }
+    struct input_behavior_listener_report *entry = &mouse_buttons.queue[idx];
+    entry->x += pending->x;
+    entry->y += pending->y;
+    entry->scroll_x += pending->scroll_x;
+    entry->scroll_y += pending->scroll_y;
+    entry->buttons = state;
+    pending->x = pending->y = pending->scroll_x = pending->scroll_y = 0;
+}
 
-        if (data->mouse.data.mode == INPUT_LISTENER_XY_DATA_MODE_REL) {
-            if (config->rotate_deg > 0) {
-                float x = data->mouse.data.x;
-                float y = data->mouse.data.y;
-                data->mouse.data.x = (data->mouse.cos * x) - (data->mouse.sin * y);
-                data->mouse.data.y = (data->mouse.sin * x) + (data->mouse.cos * y);
+static inline int32_t take_report_chunk(int32_t *pending, int32_t max) {
+    int32_t chunk = CLAMP(*pending, -max, max);
+    *pending -= chunk;
+    return chunk;
+}
+
+/*
+ * Sends one report worth of the pending deltas, returns true if more is left for another one.
+ * Queued button states go out one per report, each with the motion made while it held.
+ */
+static bool flush_report_chunk(struct input_behavior_listener_data *data) {
+    struct input_behavior_listener_report report;
+
+    k_spinlock_key_t key = k_spin_lock(&mouse_buttons.lock);
+    k_spinlock_key_t mouse_key = k_spin_lock(&data->mouse.lock);
+    struct input_behavior_listener_report *motion = &data->mouse.pending;
+    report.buttons = mouse_buttons.sent;
+    if (mouse_buttons.queue_len) {
+        struct input_behavior_listener_report *head =
+            &mouse_buttons.queue[mouse_buttons.queue_head];
+        if (report_has_motion(head)) {
+            // made before the change, so it goes out in the state the host has now
+            motion = head;
+        } else {
+            report.buttons = head->buttons;
+            mouse_buttons.queue_head = (mouse_buttons.queue_head + 1) % IBL_BUTTON_QUEUE_LEN;
+            mouse_buttons.queue_len--;
+            if (mouse_buttons.queue_len) {
+                motion = &mouse_buttons.queue[mouse_buttons.queue_head];
             }
-            #if IS_ENABLED(CONFIG_ZMK_MOUSE)
-                zmk_hid_mouse_movement_set(data->mouse.data.x, data->mouse.data.y);
-            #endif
         }
+    }
+    report.x = take_report_chunk(&motion->x, IBL_REPORT_MOVE_MAX);
+    report.y = take_report_chunk(&motion->y, IBL_REPORT_MOVE_MAX);
+    report.scroll_x = take_report_chunk(&motion->scroll_x, IBL_REPORT_SCROLL_MAX);
+    report.scroll_y = take_report_chunk(&motion->scroll_y, IBL_REPORT_SCROLL_MAX);
+    bool more = mouse_buttons.queue_len || report_has_motion(&data->mouse.pending);
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+    // the first chunk carries the latency sample, overflow chunks are not new input
+    uint32_t start = data->mouse.report_start;
+    data->mouse.report_start = 0;
+#endif
+    k_spin_unlock(&data->mouse.lock, mouse_key);
 
-        if (data->mouse.button_set != 0) {
-            for (int i = 0; i < ZMK_MOUSE_HID_NUM_BUTTONS; i++) {
-                if ((data->mouse.button_set & BIT(i)) != 0) {
-                    #if IS_ENABLED(CONFIG_ZMK_MOUSE)
-                        zmk_hid_mouse_button_press(i);
-                    #endif
-                }
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_PACING)
+    data->mouse.last_flush = k_uptime_get_32();
+#endif
+
+    // Syncs whose values were all swallowed or zeroed by bindings would otherwise go out as
+    // empty reports, costing airtime for nothing.
+    uint8_t pressed = report.buttons & ~mouse_buttons.sent;
+    uint8_t released = mouse_buttons.sent & ~report.buttons;
+    if (!report_has_motion(&report) && !pressed && !released) {
+        k_spin_unlock(&mouse_buttons.lock, key);
+        return more;
+    }
+    mouse_buttons.sent = report.buttons;
+    k_spin_unlock(&mouse_buttons.lock, key);
+    IBL_STATS_INC(data, reports);
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPLAY)
+    if (atomic_get(&replay.active)) {
+        uint8_t bytes[] = {report.x, report.x >> 8, report.y, report.y >> 8,
+                           report.scroll_x, report.scroll_y, report.buttons};
+        replay.crc = crc32_ieee_update(replay.crc, bytes, sizeof(bytes));
+        replay.reports++;
+        return more;
+    }
+#endif
+
+    #if IS_ENABLED(CONFIG_ZMK_MOUSE)
+        zmk_hid_mouse_scroll_set(report.scroll_x, report.scroll_y);
+        zmk_hid_mouse_movement_set(report.x, report.y);
+
+        for (int i = 0; i < ZMK_MOUSE_HID_NUM_BUTTONS; i++) {
+            if ((pressed & BIT(i)) != 0) {
+                zmk_hid_mouse_button_press(i);
+            }
+            if ((released & BIT(i)) != 0) {
+                zmk_hid_mouse_button_release(i);
             }
         }
 
-        if (data->mouse.button_clear != 0) {
-            for (int i = 0; i < ZMK_MOUSE_HID_NUM_BUTTONS; i++) {
-                if ((data->mouse.button_clear & BIT(i)) != 0) {
-                    #if IS_ENABLED(CONFIG_ZMK_MOUSE)
-                        zmk_hid_mouse_button_release(i);
-                    #endif
-                }
-            }
+        zmk_endpoints_send_mouse_report();
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+        if (start) {
+            latency_record(&data->latency, start);
         }
+#endif
+        zmk_hid_mouse_scroll_set(0, 0);
+        zmk_hid_mouse_movement_set(0, 0);
+    #endif
 
-        #if IS_ENABLED(CONFIG_ZMK_MOUSE)
-            zmk_endpoints_send_mouse_report();
-            zmk_hid_mouse_scroll_set(0, 0);
-            zmk_hid_mouse_movement_set(0, 0);
-        #endif
+    return more;
+}
 
-        clear_xy_data(&data->mouse.data);
-        clear_xy_data(&data->mouse.wheel_data);
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_PACING)
 
-        data->mouse.button_set = data->mouse.button_clear = 0;
+// The host polls no faster than this, anything sent in between only queues up in the endpoint.
+static uint32_t report_interval_ms(void) {
+    switch (zmk_endpoints_selected().transport) {
+    case ZMK_TRANSPORT_BLE:
+        return CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_INTERVAL_BLE_MS;
+    default:
+        return CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_INTERVAL_USB_MS;
     }
 }
 
-#endif // VALID_LISTENER_COUNT > 0
+static void flush_report_work_cb(struct k_work *work) {
+    struct k_work_delayable *work_delayable = (struct k_work_delayable *)work;
+    struct input_behavior_listener_data *data = CONTAINER_OF(work_delayable,
+                                                             struct input_behavior_listener_data,
+                                                             mouse.flush_work);
+    // overflowing deltas continue in the next interval rather than flooding the endpoint
+    if (flush_report_chunk(data)) {
+        k_work_schedule(&data->mouse.flush_work, K_MSEC(report_interval_ms()));
+    }
+}
 
-#define IBL_EXTRACT_BINDING(idx, drv_inst)                                                         \
-    {                                                                                              \
-        .behavior_dev = DEVICE_DT_NAME(DT_INST_PHANDLE_BY_IDX(drv_inst, bindings, idx)),           \
-        .param1 = COND_CODE_0(DT_INST_PHA_HAS_CELL_AT_IDX(drv_inst, bindings, idx, param1), (0),   \
-                              (DT_INST_PHA_BY_IDX(drv_inst, bindings, idx, param1))),              \
-        .param2 = COND_CODE_0(DT_INST_PHA_HAS_CELL_AT_IDX(drv_inst, bindings, idx, param2), (0),   \
-                              (DT_INST_PHA_BY_IDX(drv_inst, bindings, idx, param2))),              \
+#else
+
+static void flush_report(struct input_behavior_listener_data *data) {
+    while (flush_report_chunk(data)) {
     }
+}
 
-#define IBL_INST(n)                                                                                \
-    COND_CODE_1(                                                                                   \
-        DT_NODE_HAS_STATUS(DT_INST_PHANDLE(n, device), okay),                                      \
-        (static const struct input_behavior_listener_config config_##n = {                         \
-            .xy_swap = DT_INST_PROP(n, xy_swap),                                                   \
-            .x_invert = DT_INST_PROP(n, x_invert),                                                 \
-            .y_invert = DT_INST_PROP(n, y_invert),                                                 \
-            .scale_multiplier = DT_INST_PROP(n, scale_multiplier),                                 \
-            .scale_divisor = DT_INST_PROP(n, scale_divisor),                                       \
-            .rotate_deg = DT_INST_PROP(n, rotate_deg),                                             \
-            .evt_type = DT_INST_PROP(n, evt_type),                                                 \
-            .x_input_code = DT_INST_PROP(n, x_input_code),                                         \
-            .y_input_code = DT_INST_PROP(n, y_input_code),                                         \
-            .layers_count = DT_INST_PROP_LEN(n, layers),                                           \
-            .layers = DT_INST_PROP(n, layers),                                                     \
-            .bindings_count = COND_CODE_1(                                                         \
-                DT_INST_NODE_HAS_PROP(n, bindings),                                                \
-                (DT_INST_PROP_LEN(n, bindings)), (0)),                                             \
-            .bindings = COND_CODE_1(                                                               \
-                DT_INST_NODE_HAS_PROP(n, bindings),                                                \
-                ({LISTIFY(DT_INST_PROP_LEN(n, bindings), IBL_EXTRACT_BINDING, (, ), n)}),          \
-                ({})),                                                                             \
-        };                                                                                         \
-        static struct input_behavior_listener_data data_##n = {                                    \
-            .mouse = {                                                                             \
-                .sin = sinf((DT_INST_PROP(n, rotate_deg) * M_PI / 180.0f)),                        \
-                .cos = cosf((DT_INST_PROP(n, rotate_deg) * M_PI / 180.0f)),                        \
-            },                                                                                     \
-        };                                                                                         \
-        void input_behavior_handler_##n(struct input_event *evt) {                                 \
-            input_behavior_handler(&config_##n, &data_##n, evt);                                   \
-        }                                                                                          \
-        INPUT_CALLBACK_DEFINE(DEVICE_DT_GET(DT_INST_PHANDLE(n, device)),                           \
-                             input_behavior_handler_##n);),                                        \
-        ())
+#endif
 
-DT_INST_FOREACH_STATUS_OKAY(IBL_INST)
+static void queue_report(struct input_behavior_listener_data *data) {
+    if (!data->mouse.data.x && !data->mouse.data.y && !data->mouse.wheel_data.x &&
+        !data->mouse.wheel_data.y && !data->mouse.button_set && !data->mouse.button_clear) {
+        return;
+    }
+
+    k_spinlock_key_t buttons_key = k_spin_lock(&mouse_buttons.lock);
+    k_spinlock_key_t key = k_spin_lock(&data->mouse.lock);
+    struct input_behavior_listener_report *pending = &data->mouse.pending;
+    // earlier frames' motion stays ahead of the change, this frame's goes out with it
+    if (data->mouse.button_set || data->mouse.button_clear) {
+        uint8_t pressed = mouse_buttons.state | data->mouse.button_set;
+        // pressed and released within one frame, the press goes out first
+        if (data->mouse.button_set & data->mouse.button_clear) {
+            mouse_buttons_push(pressed, pending);
+        }
+        mouse_buttons_push(pressed & ~data->mouse.button_clear, pending);
+    }
+    if (data->mouse.wheel_data.mode == INPUT_LISTENER_XY_DATA_MODE_REL) {
+        pending->scroll_x += data->mouse.wheel_data.x;
+        pending->scroll_y += data->mouse.wheel_data.y;
+    }
+    if (data->mouse.data.mode == INPUT_LISTENER_XY_DATA_MODE_REL) {
+        pending->x += data->mouse.data.x;
+        pending->y += data->mouse.data.y;
+    }
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+    // frames coalesced into one paced report are measured from the oldest
+    if (!data->mouse.report_start) {
+        data->mouse.report_start = data->mouse.frame_start;
+    }
+#endif
+    k_spin_unlock(&data->mouse.lock, key);
+    k_spin_unlock(&mouse_buttons.lock, buttons_key);
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_PACING)
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPLAY)
+    // pacing follows wall time, replays report every frame so their stream stays reproducible
+    if (atomic_get(&replay.active)) {
+        while (flush_report_chunk(data)) {
+        }
+        return;
+    }
+#endif
+    // All paced sends go through the work item so reports never interleave on the HID state.
+    // Button edges and the first motion after an idle interval go out right away.
+    bool button_edge = data->mouse.button_set || data->mouse.button_clear;
+    uint32_t interval = report_interval_ms();
+    uint32_t elapsed = k_uptime_get_32() - data->mouse.last_flush;
+    if (button_edge || elapsed >= interval) {
+        k_work_reschedule(&data->mouse.flush_work, K_NO_WAIT);
+    } else {
+        k_work_schedule(&data->mouse.flush_work, K_MSEC(interval - elapsed));
+    }
+#else
+    flush_report(data);
+#endif
+}
+
+/*
+ * Closes the frame collected since the last sync and queues its report, returns true if a
+ * frame binding swallowed the whole frame while switching layers.
+ */
+static ALWAYS_INLINE bool sync_frame(const struct input_behavior_listener_config *config,
+                                     struct input_behavior_listener_data *data,
+                                     const bool frame_mode, const uint16_t rotate_deg,
+                                     const int32_t rotate_sin, const int32_t rotate_cos) {
+    bool handed_over = false;
+    if (frame_mode) {
+        handed_over = run_frame_behaviors(config, data);
+    }
+
+    if (rotate_deg > 0) {
+        if (data->mouse.wheel_data.mode == INPUT_LISTENER_XY_DATA_MODE_REL) {
+            rotate_xy_data(&data->mouse.wheel_data, rotate_sin, rotate_cos);
+        }
+        if (data->mouse.data.mode == INPUT_LISTENER_XY_DATA_MODE_REL) {
+            rotate_xy_data(&data->mouse.data, rotate_sin, rotate_cos);
+        }
+    }
+
+    queue_report(data);
+
+    clear_xy_data(&data->mouse.data);
+    clear_xy_data(&data->mouse.wheel_data);
+
+    data->mouse.button_set = data->mouse.button_clear = 0;
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+    data->mouse.frame_start = 0;
+#endif
+    return handed_over;
+}
+
+// Lazy deadline, only the first event after idle touches the kernel timeout.
+static inline void idle_touch(struct input_behavior_listener_data *data) {
+    atomic_set(&data->last_activity, (atomic_val_t)k_uptime_get_32());
+    if (atomic_cas(&data->idle_armed, 0, 1)) {
+        k_work_schedule(&data->idle_work, K_MSEC(ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS));
+    }
+}
+
+static inline bool frame_open(const struct input_behavior_listener_data *data) {
+    return data->mouse.data.mode != INPUT_LISTENER_XY_DATA_MODE_NONE ||
+           data->mouse.wheel_data.mode != INPUT_LISTENER_XY_DATA_MODE_NONE ||
+           data->mouse.button_set || data->mouse.button_clear;
+}
+
+/*
+ * Hands what the bindings hold back to the host once the listener saw no input for the flush
+ * idle time. It touches the collected frame and the bindings' state, so it has to run where the
+ * listener's input is handled: on the deferred thread, or without it under the route lock.
+ */
+static void flush_idle(const struct input_behavior_listener_config *cfg,
+                       struct input_behavior_listener_data *data) {
+    uint32_t idle = k_uptime_get_32() - (uint32_t)atomic_get(&data->last_activity);
+    // input came in since the work fired, or stopped halfway through a frame
+    if (idle < ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS || frame_open(data)) {
+        uint32_t wait = ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS -
+                        MIN(idle, ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS - 1);
+        k_work_schedule(&data->idle_work, K_MSEC(wait));
+        return;
+    }
+
+    struct zmk_input_behavior_frame frame = {
+        .layer = active_layer,
+        .timestamp = k_uptime_get(),
+    };
+    bool flushing = false;
+
+    for (uint8_t b = 0; b < cfg->bindings_count; b++) {
+        const struct input_behavior_listener_binding *resolved = &cfg->resolved[b];
+        struct zmk_behavior_binding binding = cfg->bindings[b];
+        if (!resolved->api) {
+            continue;
+        }
+        if (resolved->flush) {
+            resolved->flush(resolved->dev, &binding, &frame);
+            flushing = true;
+        } else if (!flushing) {
+            // bindings ahead of the first flush already saw this motion
+            continue;
+        } else if (!resolved->frame) {
+            replay_frame_events(cfg, b, resolved->api, &frame);
+        } else if (resolved->frame(resolved->dev, &binding, &frame) == ZMK_BEHAVIOR_OPAQUE) {
+            break;
+        }
+    }
+
+    // disarmed only now, the flushed frame itself must not set another deadline
+    atomic_clear(&data->idle_armed);
+    if (!frame.x && !frame.y && !frame.wheel && !frame.hwheel) {
+        return;
+    }
+    data->mouse.data.x += frame.x;
+    data->mouse.data.y += frame.y;
+    data->mouse.wheel_data.y += frame.wheel;
+    data->mouse.wheel_data.x += frame.hwheel;
+    data->mouse.data.mode = data->mouse.wheel_data.mode = INPUT_LISTENER_XY_DATA_MODE_REL;
+    sync_frame(cfg, data, false, cfg->rotate_deg, cfg->rotate_sin, cfg->rotate_cos);
+}
+
+static ALWAYS_INLINE bool
+input_behavior_handler(const struct input_behavior_listener_config *config,
+                       struct input_behavior_listener_data *data, struct input_event *evt,
+                       IBL_SPEC_PARAMS) {
+    if (data->has_flush) {
+        idle_touch(data);
+    }
+
+    // First, filter to update the event data as needed.
+    if (!intercept_with_input_config(config, evt, IBL_SPEC_ARGS)) {
+        return true;
+    }
+
+    switch (evt->type) {
+    case INPUT_EV_REL:
+        handle_rel_code(config, data, evt);
+        break;
+    case INPUT_EV_KEY:
+        handle_key_code(config, data, evt);
+        break;
+    }
+
+    if (evt->sync) {
+        return sync_frame(config, data, frame_mode, rotate_deg, rotate_sin, rotate_cos);
+    }
+    return false;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_GENERIC_HANDLER)
+static bool input_behavior_handler_generic(const struct input_behavior_listener_config *config,
+                                           struct input_behavior_listener_data *data,
+                                           struct input_event *evt) {
+    return input_behavior_handler(config, data, evt, IBL_SPEC_CFG_ARGS(config));
+}
+#endif
+
+#endif // VALID_LISTENER_COUNT > 0
+
+#define IBL_LAYER_BIT(node_id, prop, idx)                                                          \
+    (((uint32_t)DT_PROP_BY_IDX(node_id, prop, idx) < 32)                                           \
+         ? BIT(DT_PROP_BY_IDX(node_id, prop, idx) & 0x1f)                                          \
+         : 0) |
+
+#define IBL_EXTRACT_BINDING(idx, drv_inst)                                                         \
+    {                                                                                              \
+        .behavior_dev = DEVICE_DT_NAME(DT_INST_PHANDLE_BY_IDX(drv_inst, bindings, idx)),           \
+        .param1 = COND_CODE_0(DT_INST_PHA_HAS_CELL_AT_IDX(drv_inst, bindings, idx, param1), (0),   \
+                              (DT_INST_PHA_BY_IDX(drv_inst, bindings, idx, param1))),              \
+        .param2 = COND_CODE_0(DT_INST_PHA_HAS_CELL_AT_IDX(drv_inst, bindings, idx, param2), (0),   \
+                              (DT_INST_PHA_BY_IDX(drv_inst, bindings, idx, param2))),              \
+    }
+
+#define IBL_SPEC_INST_ARGS(n)                                                                      \
+    DT_INST_PROP(n, evt_type), DT_INST_PROP(n, x_input_code), DT_INST_PROP(n, y_input_code),       \
+        DT_INST_PROP(n, xy_swap), DT_INST_PROP(n, x_invert), DT_INST_PROP(n, y_invert),            \
+        DT_INST_PROP(n, scale_multiplier), DT_INST_PROP(n, scale_divisor),                         \
+        DT_INST_PROP(n, rotate_deg), IBL_SIN_Q15(DT_INST_PROP(n, rotate_deg)),                     \
+        IBL_COS_Q15(DT_INST_PROP(n, rotate_deg)), DT_INST_PROP(n, frame_mode)
+
+#if IBL_DIAG
+#define IBL_NAME_INIT(n) .name = DT_NODE_FULL_NAME(DT_DRV_INST(n)),
+#else
+#define IBL_NAME_INIT(n)
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_GENERIC_HANDLER)
+#define IBL_HANDLER_DEFINE(n)
+#define IBL_HANDLER(n) input_behavior_handler_generic
+#else
+#define IBL_HANDLER_DEFINE(n)                                                                      \
+    static bool input_behavior_handler_##n(const struct input_behavior_listener_config *config,    \
+                                           struct input_behavior_listener_data *data,              \
+                                           struct input_event *evt) {                              \
+        return input_behavior_handler(config, data, evt, IBL_SPEC_INST_ARGS(n));                   \
+    }
+#define IBL_HANDLER(n) input_behavior_handler_##n
+#endif
+
+#define IBL_INST(n)                                                                                \
+    COND_CODE_1(                                                                                   \
+        DT_NODE_HAS_STATUS(DT_INST_PHANDLE(n, device), okay),                                      \
+        (IBL_HANDLER_DEFINE(n)                                                                     \
+        static struct input_behavior_listener_binding resolved_##n[COND_CODE_1(                   \
+            DT_INST_NODE_HAS_PROP(n, bindings), (DT_INST_PROP_LEN(n, bindings)), (1))];            \
+        static struct input_behavior_listener_data data_##n;                                       \
+        static const struct input_behavior_listener_config config_##n = {                          \
+            .dev = DEVICE_DT_GET(DT_INST_PHANDLE(n, device)),                                      \
+            IBL_NAME_INIT(n)                                                                       \
+            .data = &data_##n,                                                                     \
+            .handler = IBL_HANDLER(n),                                                             \
+            .resolved = resolved_##n,                                                              \
+            .xy_swap = DT_INST_PROP(n, xy_swap),                                                   \
+            .x_invert = DT_INST_PROP(n, x_invert),                                                 \
+            .y_invert = DT_INST_PROP(n, y_invert),                                                 \
+            .frame_mode = DT_INST_PROP(n, frame_mode),                                             \
+            .scale_multiplier = DT_INST_PROP(n, scale_multiplier),                                 \
+            .scale_divisor = DT_INST_PROP(n, scale_divisor),                                       \
+            .rotate_deg = DT_INST_PROP(n, rotate_deg),                                             \
+            .rotate_sin = IBL_SIN_Q15(DT_INST_PROP(n, rotate_deg)),                                \
+            .rotate_cos = IBL_COS_Q15(DT_INST_PROP(n, rotate_deg)),                                \
+            .evt_type = DT_INST_PROP(n, evt_type),                                                 \
+            .x_input_code = DT_INST_PROP(n, x_input_code),                                         \
+            .y_input_code = DT_INST_PROP(n, y_input_code),                                         \
+            .layers = (DT_INST_FOREACH_PROP_ELEM(n, layers, IBL_LAYER_BIT) 0),                     \
+            .bindings_count = COND_CODE_1(                                                         \
+                DT_INST_NODE_HAS_PROP(n, bindings),                                                \
+                (DT_INST_PROP_LEN(n, bindings)), (0)),                                             \
+            .bindings = COND_CODE_1(                                                               \
+                DT_INST_NODE_HAS_PROP(n, bindings),                                                \
+                ({LISTIFY(DT_INST_PROP_LEN(n, bindings), IBL_EXTRACT_BINDING, (, ), n)}),          \
+                ({})),                                                                             \
+        };),                                                                                       \
+        ())
+
+DT_INST_FOREACH_STATUS_OKAY(IBL_INST)
+
+#if VALID_LISTENER_COUNT > 0
+
+#define IBL_CONFIG_REF(n)                                                                          \
+    COND_CODE_1(DT_NODE_HAS_STATUS(DT_INST_PHANDLE(n, device), okay), (&config_##n, ), ())
+
+static const struct input_behavior_listener_config *const listener_configs[] = {
+    DT_INST_FOREACH_STATUS_OKAY(IBL_CONFIG_REF)};
+
+/*
+ * One route per physical input device. Each route maps a layer straight to the listeners that
+ * own it on that device, so an event costs one callback and one table lookup no matter how many
+ * layer specific listeners share the sensor.
+ */
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+
+#define IBL_RING_LEN CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED_RING_SIZE
+BUILD_ASSERT(IS_POWER_OF_TWO(IBL_RING_LEN), "Deferred ring size must be a power of two");
+
+// Relative codes that are merged instead of dropped while the ring is full.
+#define IBL_MERGE_CODES (INPUT_REL_MISC + 1)
+#define IBL_MERGE_SYNC BIT(31)
+// Slots relative motion leaves free, so a key can always flush the parked motion ahead of it.
+#define IBL_KEY_RESERVE (IBL_MERGE_CODES + 1)
+BUILD_ASSERT(IBL_RING_LEN >= 2 * IBL_KEY_RESERVE, "Deferred ring size must be at least 32");
+
+// Compact copy of an input_event, the device is implied by the route owning the ring.
+struct input_behavior_listener_event {
+    uint16_t code;
+    uint8_t type;
+    uint8_t sync;
+    int32_t value;
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+    uint32_t stamp;
+#endif
+};
+
+#endif
+
+struct input_behavior_listener_route {
+    const struct device *dev;
+    uint32_t listeners_by_layer[ZMK_KEYMAP_LAYERS_LEN];
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+    // every listener of the device, the ones outside the active layer count as rejected
+    uint32_t listeners;
+#endif
+    // last ABS_X/ABS_Y of the current touch, bit per axis in abs_valid once seen
+    int32_t abs_last[2];
+    uint8_t abs_valid;
+    // frame mode listeners of the device, and the raw frame since the last sync that one of
+    // them may have to hand to the listeners of a layer it switched to
+    uint32_t frame_listeners;
+    struct zmk_input_behavior_frame frame;
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+    // listeners whose idle flush is due, run by the deferred thread after its next drain
+    atomic_t flush_due;
+    // each input device reports from one driver context, so one ring per device stays SPSC
+    struct zmk_input_behavior_spsc ring;
+    struct input_behavior_listener_event events[IBL_RING_LEN];
+    // relative motion parked by the producer while the ring is nearly full, drained by the
+    // consumer or flushed back into the ring by the producer ahead of a key event. Codes, values
+    // and the sync bit only change together under merge_lock, merge_codes is also read without
+    // it as the "motion is parked" hint.
+    struct k_spinlock merge_lock;
+    atomic_t merge_codes;
+    int32_t merge_values[IBL_MERGE_CODES];
+    atomic_t merged;
+    atomic_t dropped;
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+    // stamp of the oldest parked delta
+    atomic_t merge_stamp;
+#endif
+#else
+    // a listener of the device has a flushing binding, so the idle work and the thread that
+    // reports input both take lock around the listeners
+    bool has_flush;
+    struct k_mutex lock;
+#endif
+};
+
+static struct input_behavior_listener_route routes[VALID_LISTENER_COUNT];
+static uint8_t routes_count;
+
+static struct input_behavior_listener_route *get_route(const struct device *dev) {
+    for (uint8_t i = 0; i < routes_count; i++) {
+        if (routes[i].dev == dev) {
+            return &routes[i];
+        }
+    }
+    return NULL;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+
+// The deferred thread owns the listeners, nothing else runs them.
+#define route_lock(route)
+#define route_unlock(route)
+
+// Runs the idle flushes the work queue marked due, on the thread that owns the listeners.
+static void run_due_flushes(struct input_behavior_listener_route *route) {
+    for (uint32_t due = atomic_clear(&route->flush_due); due; due &= due - 1) {
+        const struct input_behavior_listener_config *cfg =
+            listener_configs[u32_count_trailing_zeros(due)];
+        flush_idle(cfg, cfg->data);
+    }
+}
+
+#else
+
+static inline void route_lock(struct input_behavior_listener_route *route) {
+    if (route->has_flush) {
+        __ASSERT(!k_is_in_isr(), "flushing bindings need input reported from a thread");
+        k_mutex_lock(&route->lock, K_FOREVER);
+    }
+}
+
+static inline void route_unlock(struct input_behavior_listener_route *route) {
+    if (route->has_flush) {
+        k_mutex_unlock(&route->lock);
+    }
+}
+
+#endif
+
+/*
+ * Touchpads report absolute positions. Turning them into motion since the previous sample of
+ * the same touch here, once per device, lets every listener treat them like a relative device
+ * from the transforms down to the HID report. A touch lift starts the next touch from zero.
+ */
+static void abs_to_rel(struct input_behavior_listener_route *route, struct input_event *evt) {
+    if (evt->type == INPUT_EV_KEY && evt->code == INPUT_BTN_TOUCH && !evt->value) {
+        route->abs_valid = 0;
+        return;
+    }
+    if (evt->type != INPUT_EV_ABS || (evt->code != INPUT_ABS_X && evt->code != INPUT_ABS_Y)) {
+        return;
+    }
+
+    uint8_t axis = (evt->code == INPUT_ABS_X) ? 0 : 1;
+    int32_t pos = evt->value;
+    evt->value = (route->abs_valid & BIT(axis)) ? pos - route->abs_last[axis] : 0;
+    route->abs_last[axis] = pos;
+    route->abs_valid |= BIT(axis);
+
+    evt->type = INPUT_EV_REL;
+    evt->code = axis ? INPUT_REL_Y : INPUT_REL_X;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE)
+
+/*
+ * Raw event capture, one record per event as it arrives from the input subsystem. Varints are
+ * LEB128, a record is
+ *   header  bits 0-1 type (IBL_CAPTURE_*), bit 2 sync, bits 3-7 route index
+ *   type    varint, only for IBL_CAPTURE_OTHER
+ *   delta   varint, microseconds since the previous record
+ *   code    varint
+ *   value   zigzag varint
+ * so a 1 kHz sensor costs about 5 bytes per axis. Once full the oldest records are dropped
+ * whole, the ring always starts on a record boundary.
+ */
+#define IBL_CAPTURE_LEN CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE_SIZE
+BUILD_ASSERT(IS_POWER_OF_TWO(IBL_CAPTURE_LEN), "Capture size must be a power of two");
+#define IBL_CAPTURE_RECORD_MAX (1 + 3 + 5 + 3 + 5)
+#define IBL_CAPTURE_SYNC BIT(2)
+#define IBL_CAPTURE_ROUTE_SHIFT 3
+
+enum input_behavior_listener_capture_type {
+    IBL_CAPTURE_REL,
+    IBL_CAPTURE_KEY,
+    IBL_CAPTURE_ABS,
+    IBL_CAPTURE_OTHER,
+};
+
+static struct {
+    struct k_spinlock lock;
+    uint8_t buf[IBL_CAPTURE_LEN];
+    // free running, masked on access
+    uint32_t head;
+    uint32_t tail;
+    uint32_t last_cycles;
+    // off at boot, "ibl capture start" turns it on
+    atomic_t enabled;
+} capture;
+
+static uint8_t capture_put_varint(uint8_t *out, uint32_t value) {
+    uint8_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+    return len;
+}
+
+static uint32_t capture_skip_varint(uint32_t pos) {
+    while (capture.buf[pos++ & (IBL_CAPTURE_LEN - 1)] & 0x80) {
+    }
+    return pos;
+}
+
+static void capture_drop_oldest(void) {
+    uint32_t pos = capture.tail;
+    uint8_t header = capture.buf[pos++ & (IBL_CAPTURE_LEN - 1)];
+    uint8_t fields = ((header & 0x3) == IBL_CAPTURE_OTHER) ? 4 : 3;
+    for (uint8_t i = 0; i < fields; i++) {
+        pos = capture_skip_varint(pos);
+    }
+    capture.tail = pos;
+}
+
+static void capture_event(uint8_t route, const struct input_event *evt) {
+    if (!atomic_get(&capture.enabled)) {
+        return;
+    }
+
+    uint8_t type = evt->type == INPUT_EV_REL   ? IBL_CAPTURE_REL
+                   : evt->type == INPUT_EV_KEY ? IBL_CAPTURE_KEY
+                   : evt->type == INPUT_EV_ABS ? IBL_CAPTURE_ABS
+                                               : IBL_CAPTURE_OTHER;
+    uint8_t record[IBL_CAPTURE_RECORD_MAX];
+    uint8_t len = 0;
+    record[len++] =
+        type | (evt->sync ? IBL_CAPTURE_SYNC : 0) | (route << IBL_CAPTURE_ROUTE_SHIFT);
+    if (type == IBL_CAPTURE_OTHER) {
+        len += capture_put_varint(&record[len], evt->type);
+    }
+
+    // the time delta is taken under the lock, so records of several devices stay in order
+    k_spinlock_key_t key = k_spin_lock(&capture.lock);
+    if (atomic_get(&capture.enabled)) {
+        uint32_t now = k_cycle_get_32();
+        len += capture_put_varint(&record[len], k_cyc_to_us_floor32(now - capture.last_cycles));
+        capture.last_cycles = now;
+        len += capture_put_varint(&record[len], evt->code);
+        len += capture_put_varint(&record[len],
+                                  ((uint32_t)evt->value << 1) ^ (uint32_t)(evt->value >> 31));
+
+        while (IBL_CAPTURE_LEN - (capture.head - capture.tail) < len) {
+            capture_drop_oldest();
+        }
+        for (uint8_t i = 0; i < len; i++) {
+            capture.buf[(capture.head + i) & (IBL_CAPTURE_LEN - 1)] = record[i];
+        }
+        capture.head += len;
+    }
+    k_spin_unlock(&capture.lock, key);
+}
+
+#endif
+
+static void frame_collect(struct zmk_input_behavior_frame *frame, const struct input_event *evt) {
+    if (evt->type == INPUT_EV_REL) {
+        int32_t *value = zmk_input_behavior_frame_field(frame, evt->code);
+        if (value) {
+            *value += evt->value;
+        }
+    } else if (evt->type == INPUT_EV_KEY && evt->code >= INPUT_BTN_0 &&
+               evt->code < INPUT_BTN_0 + ZMK_MOUSE_HID_NUM_BUTTONS) {
+        uint8_t *buttons = evt->value > 0 ? &frame->button_set : &frame->button_clear;
+        WRITE_BIT(*buttons, evt->code - INPUT_BTN_0, 1);
+    }
+}
+
+// Turns the raw frame back into events, the last one carrying the sync.
+static uint8_t frame_events(const struct input_behavior_listener_route *route,
+                            const struct input_event *sync_evt, struct input_event *evts) {
+    struct zmk_input_behavior_frame frame = route->frame;
+    uint8_t len = 0;
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(frame_rel_codes); i++) {
+        int32_t value = *zmk_input_behavior_frame_field(&frame, frame_rel_codes[i]);
+        if (value) {
+            evts[len++] = (struct input_event){
+                .dev = route->dev, .type = INPUT_EV_REL, .code = frame_rel_codes[i],
+                .value = value};
+        }
+    }
+    for (uint8_t i = 0; i < ZMK_MOUSE_HID_NUM_BUTTONS; i++) {
+        if ((frame.button_set | frame.button_clear) & BIT(i)) {
+            evts[len++] = (struct input_event){
+                .dev = route->dev, .type = INPUT_EV_KEY, .code = INPUT_BTN_0 + i,
+                .value = !!(frame.button_set & BIT(i))};
+        }
+    }
+
+    if (!len) {
+        evts[len++] = *sync_evt;
+    }
+    evts[len - 1].sync = true;
+    return len;
+}
+
+/*
+ * A binding may switch layers synchronously while handling the event (tog-layer with
+ * sync-activation). The layer_state_changed listener runs re-entrantly from inside that
+ * binding, so the dispatcher only compares generations after each listener and then hands
+ * the same event to the listeners of the new layer that have not seen it yet. A listener gets
+ * the event a second time only if its bindings swallowed it while switching layers. A frame mode
+ * listener that swallows its frame that way hands the new layer the whole frame collected since
+ * the last sync rather than just the event carrying the sync.
+ */
+static void process_event(struct input_behavior_listener_route *route,
+                          const struct input_event *raw_evt, uint32_t stamp) {
+    uint32_t done = 0;
+
+    struct input_event rel_evt = *raw_evt;
+    abs_to_rel(route, &rel_evt);
+    const struct input_event *evts = &rel_evt;
+    uint8_t evts_len = 1;
+    struct input_event frame_evts[ARRAY_SIZE(frame_rel_codes) + ZMK_MOUSE_HID_NUM_BUTTONS];
+
+    if (route->frame_listeners) {
+        frame_collect(&route->frame, &rel_evt);
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+    uint32_t rejected = route->listeners & ~route->listeners_by_layer[active_layer];
+    while (rejected) {
+        uint8_t i = u32_count_trailing_zeros(rejected);
+        rejected &= rejected - 1;
+        IBL_STATS_INC(listener_configs[i]->data, rejected);
+    }
+#endif
+
+    k_tid_t self = k_current_get();
+
+    for (uint8_t hop = 0; hop < IBL_MAX_LAYER_HOPS; hop++) {
+        atomic_val_t generation = atomic_get(&layer_generation);
+        uint32_t listeners = route->listeners_by_layer[active_layer] & ~done;
+        bool layer_changed = false;
+
+        while (listeners) {
+            uint8_t i = u32_count_trailing_zeros(listeners);
+            listeners &= listeners - 1;
+
+            const struct input_behavior_listener_config *cfg = listener_configs[i];
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+            if (!cfg->data->mouse.frame_start) {
+                cfg->data->mouse.frame_start = stamp;
+            }
+#endif
+            bool consumed = false;
+            for (uint8_t e = 0; e < evts_len; e++) {
+                // listeners rewrite the event in place, keep the original for the next one
+                struct input_event listener_evt = evts[e];
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+                IBL_STATS_INC(cfg->data, events);
+                uint32_t start = k_cycle_get_32();
+                consumed = cfg->handler(cfg, cfg->data, &listener_evt);
+                stats_handler_cycles(&cfg->data->stats, k_cycle_get_32() - start);
+#else
+                consumed = cfg->handler(cfg, cfg->data, &listener_evt);
+#endif
+            }
+            done |= BIT(i);
+
+            // layer changes from other threads (tog-layer work, keymap presses) are picked up
+            // by the next event, only a switch made by this event's own bindings is followed
+            if (atomic_get(&layer_generation) != generation &&
+                atomic_ptr_get(&layer_changed_by) == (atomic_ptr_val_t)self) {
+                if (consumed) {
+                    // the switching binding let go of the event, so its listener may take it
+                    done &= ~BIT(i);
+                }
+                if (consumed && (route->frame_listeners & BIT(i)) && rel_evt.sync) {
+                    evts_len = frame_events(route, &rel_evt, frame_evts);
+                    evts = frame_evts;
+                }
+                layer_changed = true;
+                break;
+            }
+        }
+
+        if (!layer_changed) {
+            break;
+        }
+    }
+
+    if (rel_evt.sync) {
+        route->frame = (struct zmk_input_behavior_frame){0};
+    }
+}
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+
+K_SEM_DEFINE(deferred_sem, 0, 1);
+
+static void ring_put(struct input_behavior_listener_route *route, uint8_t type, uint16_t code,
+                     bool sync, int32_t value, uint32_t stamp) {
+    uint32_t idx = zmk_input_behavior_spsc_produce_idx(&route->ring, IBL_RING_LEN);
+    route->events[idx] = (struct input_behavior_listener_event){
+        .code = code,
+        .type = type,
+        .sync = sync,
+        .value = value,
+        IF_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY, (.stamp = stamp, ))};
+    zmk_input_behavior_spsc_produce_commit(&route->ring);
+}
+
+// Snapshot of the parked motion, see take_merged().
+struct input_behavior_listener_merged {
+    uint32_t codes;
+    uint32_t stamp;
+    int32_t values[IBL_MERGE_CODES];
+};
+
+/*
+ * Takes all parked motion in one step. A delta merged concurrently lands either completely in
+ * this snapshot, value, code and sync bit alike, or completely in the next one.
+ */
+static void take_merged(struct input_behavior_listener_route *route,
+                        struct input_behavior_listener_merged *merged) {
+    k_spinlock_key_t key = k_spin_lock(&route->merge_lock);
+    merged->codes = atomic_clear(&route->merge_codes);
+    merged->stamp = COND_CODE_1(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY,
+                                (atomic_clear(&route->merge_stamp)), (0));
+    for (uint32_t codes = merged->codes & ~IBL_MERGE_SYNC; codes; codes &= codes - 1) {
+        uint8_t code = u32_count_trailing_zeros(codes);
+        merged->values[code] = route->merge_values[code];
+        route->merge_values[code] = 0;
+    }
+    k_spin_unlock(&route->merge_lock, key);
+}
+
+// Moves the parked motion back into the ring, the consumer finds no codes left to take.
+static void unpark_motion(struct input_behavior_listener_route *route) {
+    struct input_behavior_listener_merged merged;
+    take_merged(route, &merged);
+
+    bool sync = merged.codes & IBL_MERGE_SYNC;
+    uint32_t codes = merged.codes & ~IBL_MERGE_SYNC;
+    while (codes) {
+        uint8_t code = u32_count_trailing_zeros(codes);
+        codes &= codes - 1;
+        ring_put(route, INPUT_EV_REL, code, sync && !codes, merged.values[code], merged.stamp);
+    }
+}
+
+static void push_event(struct input_behavior_listener_route *route, struct input_event *evt,
+                       uint32_t stamp) {
+    uint32_t space = zmk_input_behavior_spsc_space(&route->ring, IBL_RING_LEN);
+
+    if (evt->type == INPUT_EV_REL && evt->code < IBL_MERGE_CODES) {
+        // Once motion is parked, keep merging until it was picked up so that relative deltas
+        // are never reordered.
+        if (atomic_get(&route->merge_codes) || space <= IBL_KEY_RESERVE) {
+            k_spinlock_key_t key = k_spin_lock(&route->merge_lock);
+            route->merge_values[evt->code] += evt->value;
+            atomic_or(&route->merge_codes, BIT(evt->code) | (evt->sync ? IBL_MERGE_SYNC : 0));
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+            atomic_cas(&route->merge_stamp, 0, stamp);
+#endif
+            k_spin_unlock(&route->merge_lock, key);
+            atomic_inc(&route->merged);
+            k_sem_give(&deferred_sem);
+            return;
+        }
+    } else {
+        // Keys must neither be lost to parked motion nor overtake it. Only when the reserve is
+        // used up by keys the consumer has not reached yet does a key go ahead of the motion.
+        uint32_t parked = atomic_get(&route->merge_codes) & ~IBL_MERGE_SYNC;
+        if (parked && space > (uint32_t)popcount(parked)) {
+            unpark_motion(route);
+            space = zmk_input_behavior_spsc_space(&route->ring, IBL_RING_LEN);
+        }
+    }
+
+    if (space) {
+        ring_put(route, evt->type, evt->code, evt->sync, evt->value, stamp);
+    } else {
+        atomic_inc(&route->dropped);
+    }
+    k_sem_give(&deferred_sem);
+}
+
+static void drain_route(struct input_behavior_listener_route *route) {
+    struct input_event evt = {.dev = route->dev};
+
+    while (!zmk_input_behavior_spsc_empty(&route->ring)) {
+        uint32_t idx = zmk_input_behavior_spsc_consume_idx(&route->ring, IBL_RING_LEN);
+        struct input_behavior_listener_event event = route->events[idx];
+        zmk_input_behavior_spsc_consume_release(&route->ring);
+
+        evt.code = event.code;
+        evt.type = event.type;
+        evt.sync = event.sync;
+        evt.value = event.value;
+        process_event(route, &evt, COND_CODE_1(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY,
+                                               (event.stamp), (0)));
+    }
+
+    if (!atomic_get(&route->merge_codes)) {
+        return;
+    }
+
+    struct input_behavior_listener_merged merged;
+    take_merged(route, &merged);
+
+    bool sync = merged.codes & IBL_MERGE_SYNC;
+    uint32_t codes = merged.codes & ~IBL_MERGE_SYNC;
+    while (codes) {
+        uint8_t code = u32_count_trailing_zeros(codes);
+        codes &= codes - 1;
+
+        evt.type = INPUT_EV_REL;
+        evt.code = code;
+        evt.value = merged.values[code];
+        evt.sync = sync && !codes;
+        process_event(route, &evt, merged.stamp);
+    }
+}
+
+static void drain_route_and_flush(struct input_behavior_listener_route *route) {
+    drain_route(route);
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPLAY)
+    // a replay runs the listeners on its own thread and its flushes with them
+    if (atomic_get(&replay.blocked)) {
+        return;
+    }
+#endif
+    run_due_flushes(route);
+}
+
+static void input_behavior_listener_deferred_thread(void *p1, void *p2, void *p3) {
+    while (true) {
+        k_sem_take(&deferred_sem, K_FOREVER);
+        for (uint8_t i = 0; i < routes_count; i++) {
+            drain_route_and_flush(&routes[i]);
+        }
+    }
+}
+
+K_THREAD_DEFINE(input_behavior_listener_deferred,
+                CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED_STACK_SIZE,
+                input_behavior_listener_deferred_thread, NULL, NULL, NULL,
+                CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED_THREAD_PRIORITY, 0, 0);
+
+#endif
+
+static void input_behavior_listener_dispatch(struct input_behavior_listener_route *route,
+                                             struct input_event *evt) {
+    // input that arrives before init has no route yet
+    if (!route) {
+        return;
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPLAY)
+    if (atomic_get(&replay.blocked)) {
+        return;
+    }
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE)
+    capture_event(route - routes, evt);
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+    push_event(route, evt, IBL_LATENCY_STAMP());
+#else
+    route_lock(route);
+    process_event(route, evt, IBL_LATENCY_STAMP());
+    route_unlock(route);
+#endif
+}
+
+/*
+ * One input callback per device, defined by the first listener on it, so the input subsystem
+ * only calls in for devices that have listeners and the route comes from that listener's data
+ * instead of a lookup by device.
+ */
+#define IBL_SAME_DEV_BEFORE(m, n)                                                                  \
+    IF_ENABLED(DT_SAME_NODE(DT_INST_PHANDLE(m, device), DT_INST_PHANDLE(n, device)), (1))
+
+#define IBL_FIRST_ON_DEV(n) IS_EMPTY(LISTIFY(n, IBL_SAME_DEV_BEFORE, (), n))
+
+#define IBL_DEVICE_CALLBACK_DEFINE(n)                                                              \
+    static void input_behavior_listener_dispatch_##n(struct input_event *evt) {                    \
+        input_behavior_listener_dispatch(data_##n.route, evt);                                     \
+    }                                                                                              \
+    INPUT_CALLBACK_DEFINE(DEVICE_DT_GET(DT_INST_PHANDLE(n, device)),                               \
+                          input_behavior_listener_dispatch_##n);
+
+#define IBL_DEVICE_CALLBACK(n)                                                                     \
+    COND_CODE_1(DT_NODE_HAS_STATUS(DT_INST_PHANDLE(n, device), okay),                              \
+                (COND_CODE_1(IBL_FIRST_ON_DEV(n), (IBL_DEVICE_CALLBACK_DEFINE(n)), ())), ())
+
+DT_INST_FOREACH_STATUS_OKAY(IBL_DEVICE_CALLBACK)
+
+static void idle_work_cb(struct k_work *work) {
+    struct k_work_delayable *work_delayable = (struct k_work_delayable *)work;
+    struct input_behavior_listener_data *data =
+        CONTAINER_OF(work_delayable, struct input_behavior_listener_data, idle_work);
+
+    // input arrived since this deadline was set, sleep until the one it implies
+    uint32_t idle = k_uptime_get_32() - (uint32_t)atomic_get(&data->last_activity);
+    if (idle < ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS) {
+        k_work_schedule(work_delayable, K_MSEC(ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS - idle));
+        return;
+    }
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        if (listener_configs[i]->data != data) {
+            continue;
+        }
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+        atomic_or(&data->route->flush_due, BIT(i));
+        k_sem_give(&deferred_sem);
+#else
+        route_lock(data->route);
+        flush_idle(listener_configs[i], data);
+        route_unlock(data->route);
+#endif
+    }
+}
+
+static int input_behavior_listener_init(void) {
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        const struct input_behavior_listener_config *cfg = listener_configs[i];
+
+        struct input_behavior_listener_route *route = get_route(cfg->dev);
+        if (!route) {
+            route = &routes[routes_count++];
+            route->dev = cfg->dev;
+#if !IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+            k_mutex_init(&route->lock);
+#endif
+        }
+        cfg->data->route = route;
+        if (cfg->frame_mode) {
+            route->frame_listeners |= BIT(i);
+        }
+        for (uint8_t l = 0; l < ZMK_KEYMAP_LAYERS_LEN; l++) {
+            if (cfg->layers & BIT(l)) {
+                route->listeners_by_layer[l] |= BIT(i);
+            }
+        }
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+        route->listeners |= BIT(i);
+#if IS_ENABLED(CONFIG_STATS)
+        stats_init_and_reg(STATS_HDR(cfg->data->stats.group),
+                           STATS_SIZE_INIT_PARMS(cfg->data->stats.group, STATS_SIZE_32),
+                           STATS_NAME_INIT_PARMS(ibl), cfg->name);
+#endif
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_PACING)
+        k_work_init_delayable(&cfg->data->mouse.flush_work, flush_report_work_cb);
+#endif
+
+        // Behavior devices never change after boot, resolve the binding names once.
+        for (uint8_t b = 0; b < cfg->bindings_count; b++) {
+            const char *name = cfg->bindings[b].behavior_dev;
+            const struct device *behavior = zmk_behavior_get_binding(name);
+            if (!behavior) {
+                LOG_WRN("No behavior %s assigned to %s", name, cfg->dev->name);
+                continue;
+            }
+            cfg->resolved[b].dev = behavior;
+            cfg->resolved[b].api = (const struct behavior_driver_api *)behavior->api;
+
+            STRUCT_SECTION_FOREACH(zmk_input_behavior_frame_api, frame_api) {
+                if (frame_api->dev == behavior) {
+                    cfg->resolved[b].frame = frame_api->process;
+                    break;
+                }
+            }
+            STRUCT_SECTION_FOREACH(zmk_input_behavior_flush_api, flush_api) {
+                if (flush_api->dev == behavior) {
+                    cfg->resolved[b].flush = flush_api->flush;
+                    cfg->data->has_flush = true;
+                    break;
+                }
+            }
+        }
+        k_work_init_delayable(&cfg->data->idle_work, idle_work_cb);
+#if !IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+        route->has_flush |= cfg->data->has_flush;
+#endif
+    }
+
+    active_layer = zmk_keymap_highest_layer_active();
+    return 0;
+}
+
+SYS_INIT(input_behavior_listener_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+static int input_behavior_listener_layer_listener(const zmk_event_t *eh) {
+    active_layer = zmk_keymap_highest_layer_active();
+    atomic_ptr_set(&layer_changed_by, (atomic_ptr_val_t)k_current_get());
+    atomic_inc(&layer_generation);
+    return ZMK_EV_EVENT_BUBBLE;
+}
+
+ZMK_LISTENER(input_behavior_listener, input_behavior_listener_layer_listener);
+ZMK_SUBSCRIPTION(input_behavior_listener, zmk_layer_state_changed);
+
+#if IBL_SHELL
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+
+static int cmd_ibl_stats(const struct shell *sh, size_t argc, char **argv) {
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        const struct input_behavior_listener_config *cfg = listener_configs[i];
+        struct input_behavior_listener_stats *stats = &cfg->data->stats;
+        shell_print(sh, "%s (%s): events %ld rejected %ld opaque %ld reports %ld", cfg->name,
+                    cfg->dev->name, (long)atomic_get(&stats->events),
+                    (long)atomic_get(&stats->rejected), (long)atomic_get(&stats->opaque),
+                    (long)atomic_get(&stats->reports));
+        shell_print(sh, "  handler cycles: max %lu avg %lu",
+                    (unsigned long)atomic_get(&stats->cycles_max),
+                    (unsigned long)atomic_get(&stats->cycles_avg));
+    }
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+    for (uint8_t i = 0; i < routes_count; i++) {
+        shell_print(sh, "%s ring: merged %ld dropped %ld", routes[i].dev->name,
+                    (long)atomic_get(&routes[i].merged), (long)atomic_get(&routes[i].dropped));
+    }
+#endif
+    return 0;
+}
+
+static int cmd_ibl_reset(const struct shell *sh, size_t argc, char **argv) {
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        struct input_behavior_listener_stats *stats = &listener_configs[i]->data->stats;
+        atomic_clear(&stats->events);
+        atomic_clear(&stats->rejected);
+        atomic_clear(&stats->opaque);
+        atomic_clear(&stats->reports);
+        atomic_clear(&stats->cycles_max);
+        atomic_clear(&stats->cycles_avg);
+    }
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((ibl), stats, NULL, "Show input behavior listener counters", cmd_ibl_stats, 1,
+                 0);
+SHELL_SUBCMD_ADD((ibl), reset, NULL, "Clear input behavior listener counters", cmd_ibl_reset, 1,
+                 0);
+
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+
+static int cmd_ibl_latency(const struct shell *sh, size_t argc, char **argv) {
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        const struct input_behavior_listener_config *cfg = listener_configs[i];
+        struct input_behavior_listener_latency *latency = &cfg->data->latency;
+
+        uint32_t total = 0;
+        for (uint8_t b = 0; b < IBL_LATENCY_BUCKETS; b++) {
+            total += atomic_get(&latency->buckets[b]);
+        }
+        shell_print(sh, "%s (%s): reports %lu max %ld us", cfg->name, cfg->dev->name,
+                    (unsigned long)total, (long)atomic_get(&latency->max_us));
+
+        for (uint8_t b = 0; b < IBL_LATENCY_BUCKETS; b++) {
+            atomic_val_t count = atomic_get(&latency->buckets[b]);
+            if (!count) {
+                continue;
+            }
+            unsigned long lo = b ? BIT(b - 1) : 0;
+            if (b == IBL_LATENCY_BUCKETS - 1) {
+                shell_print(sh, "  %7lu us and up: %ld", lo, (long)count);
+            } else {
+                shell_print(sh, "  %7lu - %7lu us: %ld", lo, BIT(b) - 1, (long)count);
+            }
+        }
+    }
+    return 0;
+}
+
+static int cmd_ibl_latency_reset(const struct shell *sh, size_t argc, char **argv) {
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        struct input_behavior_listener_latency *latency = &listener_configs[i]->data->latency;
+        for (uint8_t b = 0; b < IBL_LATENCY_BUCKETS; b++) {
+            atomic_clear(&latency->buckets[b]);
+        }
+        atomic_clear(&latency->max_us);
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(ibl_latency_cmds,
+                               SHELL_CMD(reset, NULL, "Clear the latency histograms",
+                                         cmd_ibl_latency_reset),
+                               SHELL_SUBCMD_SET_END);
+SHELL_SUBCMD_ADD((ibl), latency, &ibl_latency_cmds, "Show input to report latency histograms",
+                 cmd_ibl_latency, 1, 0);
+
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE)
+
+static int cmd_ibl_capture_set(bool enabled) {
+    k_spinlock_key_t key = k_spin_lock(&capture.lock);
+    if (enabled && capture.head == capture.tail) {
+        // a fresh recording starts its clock now rather than at boot
+        capture.last_cycles = k_cycle_get_32();
+    }
+    atomic_set(&capture.enabled, enabled);
+    k_spin_unlock(&capture.lock, key);
+    return 0;
+}
+
+static int cmd_ibl_capture_start(const struct shell *sh, size_t argc, char **argv) {
+    return cmd_ibl_capture_set(true);
+}
+
+static int cmd_ibl_capture_stop(const struct shell *sh, size_t argc, char **argv) {
+    return cmd_ibl_capture_set(false);
+}
+
+static int cmd_ibl_capture_clear(const struct shell *sh, size_t argc, char **argv) {
+    k_spinlock_key_t key = k_spin_lock(&capture.lock);
+    capture.tail = capture.head;
+    k_spin_unlock(&capture.lock, key);
+    return 0;
+}
+
+// Bytes per dump line, a multiple of 3 so every base64 line stands on its own.
+#define IBL_CAPTURE_DUMP_CHUNK 48
+
+static int cmd_ibl_capture_dump(const struct shell *sh, size_t argc, char **argv) {
+    bool hex = argc > 1 && !strcmp(argv[1], "hex");
+
+    // recording pauses while the ring is printed, nothing can overwrite it under the dump
+    k_spinlock_key_t key = k_spin_lock(&capture.lock);
+    bool was_enabled = atomic_set(&capture.enabled, false);
+    uint32_t pos = capture.tail;
+    uint32_t end = capture.head;
+    k_spin_unlock(&capture.lock, key);
+
+    shell_print(sh, "ibl capture v1, %lu bytes, routes:", (unsigned long)(end - pos));
+    for (uint8_t i = 0; i < routes_count; i++) {
+        shell_print(sh, "  %u %s", i, routes[i].dev->name);
+    }
+
+    while (pos != end) {
+        uint8_t chunk[IBL_CAPTURE_DUMP_CHUNK];
+        size_t len = MIN(end - pos, sizeof(chunk));
+        for (size_t i = 0; i < len; i++) {
+            chunk[i] = capture.buf[(pos + i) & (IBL_CAPTURE_LEN - 1)];
+        }
+        pos += len;
+
+        if (hex) {
+            shell_hexdump(sh, chunk, len);
+        } else {
+            uint8_t line[IBL_CAPTURE_DUMP_CHUNK / 3 * 4 + 1];
+            size_t olen;
+            base64_encode(line, sizeof(line), &olen, chunk, len);
+            shell_print(sh, "%s", (char *)line);
+        }
+    }
+
+    cmd_ibl_capture_set(was_enabled);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    ibl_capture_cmds, SHELL_CMD(start, NULL, "Start or resume recording", cmd_ibl_capture_start),
+    SHELL_CMD(stop, NULL, "Pause recording", cmd_ibl_capture_stop),
+    SHELL_CMD(clear, NULL, "Drop everything recorded", cmd_ibl_capture_clear),
+    SHELL_CMD_ARG(dump, NULL, "Print the capture as base64, or as hex with 'hex'",
+                  cmd_ibl_capture_dump, 1, 1),
+    SHELL_SUBCMD_SET_END);
+SHELL_SUBCMD_ADD((ibl), capture, &ibl_capture_cmds, "Raw input event capture", NULL, 1, 0);
+
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPLAY)
+
+// Time after a trace for move-to-keypress to send the taps it queued.
+#define IBL_REPLAY_SETTLE_MS 500
+
+struct replay_event {
+    uint8_t route;
+    uint32_t delta_us;
+    struct input_event evt;
+};
+
+enum replay_shape {
+    IBL_REPLAY_CIRCLE,
+    IBL_REPLAY_FLICK,
+    IBL_REPLAY_JITTER,
+    IBL_REPLAY_SCROLL,
+};
+
+static const char *const replay_shape_names[] = {
+    [IBL_REPLAY_CIRCLE] = "circle",
+    [IBL_REPLAY_FLICK] = "flick",
+    [IBL_REPLAY_JITTER] = "jitter",
+    [IBL_REPLAY_SCROLL] = "scroll",
+};
+
+/*
+ * Synthetic sensor, one frame per period: X then Y with sync, or a single wheel event. All
+ * shapes are integer only and seeded the same on every run.
+ *   circle  steady circles of 128 counts radius, about 2 counts per frame (Minsky rotation)
+ *   flick   32 frames ramping up to 48 counts per frame and back, then 32 idle, alternating
+ *   jitter  -1, 0 or 1 on both axes
+ *   scroll  one wheel detent per frame
+ */
+struct replay_gen {
+    uint8_t shape;
+    uint8_t route;
+    uint32_t period_us;
+    uint32_t frames;
+    uint32_t frame;
+    // circle position in 1/256 counts
+    int32_t x;
+    int32_t y;
+    uint32_t rng;
+    uint32_t idle_us;
+    int32_t pending_y;
+    bool y_next;
+};
+
+static void replay_gen_init(struct replay_gen *gen, uint8_t shape, uint8_t route, uint32_t hz,
+                            uint32_t frames) {
+    *gen = (struct replay_gen){
+        .shape = shape,
+        .route = route,
+        .period_us = 1000000 / hz,
+        .frames = frames,
+        .x = 128 << 8,
+        .rng = 0x2545f491,
+    };
+}
+
+static bool replay_gen_next(struct replay_gen *gen, struct replay_event *out) {
+    *out = (struct replay_event){.route = gen->route, .evt = {.type = INPUT_EV_REL}};
+
+    if (gen->y_next) {
+        gen->y_next = false;
+        out->evt.code = INPUT_REL_Y;
+        out->evt.value = gen->pending_y;
+        out->evt.sync = 1;
+        return true;
+    }
+
+    while (gen->frame < gen->frames) {
+        uint32_t f = gen->frame++;
+        int32_t dx = 0;
+        int32_t dy = 0;
+
+        switch (gen->shape) {
+        case IBL_REPLAY_CIRCLE: {
+            int32_t ox = gen->x >> 8;
+            int32_t oy = gen->y >> 8;
+            gen->x -= gen->y >> 6;
+            gen->y += gen->x >> 6;
+            dx = (gen->x >> 8) - ox;
+            dy = (gen->y >> 8) - oy;
+            break;
+        }
+        case IBL_REPLAY_FLICK: {
+            uint32_t phase = f % 64;
+            if (phase >= 32) {
+                gen->idle_us += gen->period_us;
+                continue;
+            }
+            dx = 3 * (phase < 16 ? phase : 32 - phase);
+            dx = ((f / 64) & 1) ? -dx : dx;
+            dy = dx / 4;
+            break;
+        }
+        case IBL_REPLAY_JITTER:
+            gen->rng ^= gen->rng << 13;
+            gen->rng ^= gen->rng >> 17;
+            gen->rng ^= gen->rng << 5;
+            dx = (int32_t)(gen->rng % 3) - 1;
+            dy = (int32_t)((gen->rng >> 8) % 3) - 1;
+            break;
+        case IBL_REPLAY_SCROLL:
+            out->delta_us = gen->period_us + gen->idle_us;
+            gen->idle_us = 0;
+            out->evt.code = INPUT_REL_WHEEL;
+            out->evt.value = -1;
+            out->evt.sync = 1;
+            return true;
+        }
+
+        out->delta_us = gen->period_us + gen->idle_us;
+        gen->idle_us = 0;
+        out->evt.code = INPUT_REL_X;
+        out->evt.value = dx;
+        gen->pending_y = dy;
+        gen->y_next = true;
+        return true;
+    }
+    return false;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE)
+
+static uint32_t capture_get_varint(uint32_t *pos) {
+    uint32_t value = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+    do {
+        byte = capture.buf[(*pos)++ & (IBL_CAPTURE_LEN - 1)];
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 32);
+    return value;
+}
+
+// Decodes the record at pos, see capture_event for the format.
+static bool replay_capture_next(uint32_t *pos, uint32_t end, struct replay_event *out) {
+    static const uint8_t types[] = {
+        [IBL_CAPTURE_REL] = INPUT_EV_REL,
+        [IBL_CAPTURE_KEY] = INPUT_EV_KEY,
+        [IBL_CAPTURE_ABS] = INPUT_EV_ABS,
+    };
+
+    while (*pos != end) {
+        uint8_t header = capture.buf[(*pos)++ & (IBL_CAPTURE_LEN - 1)];
+        uint8_t type = header & 0x3;
+
+        *out = (struct replay_event){.route = header >> IBL_CAPTURE_ROUTE_SHIFT};
+        out->evt.type = (type == IBL_CAPTURE_OTHER) ? capture_get_varint(pos) : types[type];
+        out->delta_us = capture_get_varint(pos);
+        out->evt.code = capture_get_varint(pos);
+        uint32_t zigzag = capture_get_varint(pos);
+        out->evt.value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        out->evt.sync = !!(header & IBL_CAPTURE_SYNC);
+
+        if (out->route < routes_count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
+
+struct replay_source {
+    bool from_capture;
+    union {
+        struct replay_gen gen;
+        struct {
+            uint32_t pos;
+            uint32_t end;
+        } capture;
+    };
+};
+
+static bool replay_next(struct replay_source *src, struct replay_event *out) {
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE)
+    if (src->from_capture) {
+        return replay_capture_next(&src->capture.pos, src->capture.end, out);
+    }
+#endif
+    return replay_gen_next(&src->gen, out);
+}
+
+struct replay_opts {
+    bool check;
+    uint32_t expect;
+    uint8_t route;
+};
+
+// Trailing options: route <n>, expect <crc>.
+static int replay_parse_opts(const struct shell *sh, size_t argc, char **argv,
+                             struct replay_opts *opts) {
+    *opts = (struct replay_opts){0};
+    for (size_t i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "expect") && i + 1 < argc) {
+            opts->check = true;
+            opts->expect = strtoul(argv[++i], NULL, 16);
+        } else if (!strcmp(argv[i], "route") && i + 1 < argc) {
+            opts->route = strtoul(argv[++i], NULL, 10);
+        } else {
+            shell_error(sh, "unknown option %s", argv[i]);
+            return -EINVAL;
+        }
+    }
+    if (opts->route >= routes_count) {
+        shell_error(sh, "no route %u", opts->route);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// Puts every listener, route and behavior back into its state after boot.
+static void replay_reset(void) {
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        struct input_behavior_listener_data *data = listener_configs[i]->data;
+        // rotation remainders included, they would carry one run into the next
+        data->mouse.data = (struct input_behavior_listener_xy_data){0};
+        data->mouse.wheel_data = (struct input_behavior_listener_xy_data){0};
+        data->mouse.button_set = data->mouse.button_clear = 0;
+
+        k_spinlock_key_t key = k_spin_lock(&data->mouse.lock);
+        data->mouse.pending = (struct input_behavior_listener_report){0};
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+        data->mouse.report_start = 0;
+#endif
+        k_spin_unlock(&data->mouse.lock, key);
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_LATENCY)
+        data->mouse.frame_start = 0;
+#endif
+    }
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        struct input_behavior_listener_data *data = listener_configs[i]->data;
+        struct k_work_sync sync;
+        k_work_cancel_delayable_sync(&data->idle_work, &sync);
+        atomic_clear(&data->idle_armed);
+    }
+    k_spinlock_key_t key = k_spin_lock(&mouse_buttons.lock);
+    mouse_buttons.state = mouse_buttons.sent = 0;
+    mouse_buttons.queue_head = mouse_buttons.queue_len = 0;
+    k_spin_unlock(&mouse_buttons.lock, key);
+    for (uint8_t i = 0; i < routes_count; i++) {
+        routes[i].abs_valid = 0;
+        routes[i].frame = (struct zmk_input_behavior_frame){0};
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+        atomic_clear(&routes[i].flush_due);
+#endif
+    }
+    zmk_input_behavior_reset_all();
+}
+
+static void replay_begin(void) {
+    atomic_set(&replay.blocked, 1);
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+    // live events queued before the switch still go to the host
+    for (uint8_t i = 0; i < routes_count; i++) {
+        while (!zmk_input_behavior_spsc_empty(&routes[i].ring) ||
+               atomic_get(&routes[i].merge_codes)) {
+            k_msleep(1);
+        }
+    }
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_PACING)
+    // whatever live motion is still paced out goes to the host first
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        struct input_behavior_listener_data *data = listener_configs[i]->data;
+        k_work_cancel_delayable(&data->mouse.flush_work);
+        while (flush_report_chunk(data)) {
+        }
+    }
+#endif
+
+    replay_reset();
+    replay.reports = 0;
+    replay.crc = 0;
+    replay.key_crc = 0;
+    atomic_clear(&replay.keypresses);
+    atomic_set(&replay.active, 1);
+}
+
+static void replay_end(void) {
+    // nothing of the trace reached the host, forget it so live input starts clean
+    replay_reset();
+    atomic_clear(&replay.active);
+    atomic_clear(&replay.blocked);
+}
+
+static int replay_run(const struct shell *sh, struct replay_source *src,
+                      const struct replay_opts *opts) {
+    struct replay_event re;
+    uint32_t events = 0;
+    uint64_t cycles = 0;
+    uint64_t trace_us = 0;
+
+    replay_begin();
+    // bindings and their timers all read the kernel clock, so the trace is played on it too
+    int64_t start_us = k_ticks_to_us_floor64(k_uptime_ticks());
+
+    while (replay_next(src, &re)) {
+        trace_us += re.delta_us;
+        k_sleep(K_TIMEOUT_ABS_US(start_us + trace_us));
+
+        struct input_behavior_listener_route *route = &routes[re.route];
+        re.evt.dev = route->dev;
+        uint32_t begin = k_cycle_get_32();
+        route_lock(route);
+        process_event(route, &re.evt, IBL_LATENCY_STAMP());
+        route_unlock(route);
+        cycles += k_cycle_get_32() - begin;
+        events++;
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+        run_due_flushes(route);
+#endif
+    }
+
+    k_msleep(IBL_REPLAY_SETTLE_MS);
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+    for (uint8_t i = 0; i < routes_count; i++) {
+        run_due_flushes(&routes[i]);
+    }
+#endif
+    replay_end();
+    if (atomic_get(&replay.keypresses)) {
+        uint8_t bytes[] = {replay.key_crc, replay.key_crc >> 8, replay.key_crc >> 16,
+                           replay.key_crc >> 24};
+        replay.crc = crc32_ieee_update(replay.crc, bytes, sizeof(bytes));
+    }
+
+    uint32_t per_event = events ? (uint32_t)(cycles / events) : 0;
+    uint32_t per_sec = cycles ? (uint64_t)events * sys_clock_hw_cycles_per_sec() / cycles : 0;
+    shell_print(sh, "events %lu reports %lu keypresses %ld cycles/event %lu events/s %lu",
+                (unsigned long)events, (unsigned long)replay.reports,
+                (long)atomic_get(&replay.keypresses), (unsigned long)per_event,
+                (unsigned long)per_sec);
+    shell_print(sh, "crc 0x%08lx", (unsigned long)replay.crc);
+
+    if (opts->check && replay.crc != opts->expect) {
+        shell_error(sh, "golden mismatch, expected 0x%08lx", (unsigned long)opts->expect);
+        return -EIO;
+    }
+    return 0;
+}
+
+static int cmd_ibl_replay_gen(const struct shell *sh, size_t argc, char **argv) {
+    uint8_t shape;
+    for (shape = 0; shape < ARRAY_SIZE(replay_shape_names); shape++) {
+        if (!strcmp(argv[1], replay_shape_names[shape])) {
+            break;
+        }
+    }
+    uint32_t hz = strtoul(argv[2], NULL, 10);
+    uint32_t frames = strtoul(argv[3], NULL, 10);
+    if (shape == ARRAY_SIZE(replay_shape_names) || !hz || hz > 1000000) {
+        shell_error(sh, "usage: gen <circle|flick|jitter|scroll> <hz> <frames> [options]");
+        return -EINVAL;
+    }
+
+    struct replay_opts opts;
+    int err = replay_parse_opts(sh, argc - 4, &argv[4], &opts);
+    if (err) {
+        return err;
+    }
+
+    struct replay_source src = {.from_capture = false};
+    replay_gen_init(&src.gen, shape, opts.route, hz, frames);
+    return replay_run(sh, &src, &opts);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_CAPTURE)
+
+#define IBL_REPLAY_CAPTURE_CMD                                                                     \
+    SHELL_CMD_ARG(capture, NULL, "Replay the capture ring: [expect <crc>]",                       \
+                  cmd_ibl_replay_capture, 1, 2),
+
+static int cmd_ibl_replay_capture(const struct shell *sh, size_t argc, char **argv) {
+    struct replay_opts opts;
+    int err = replay_parse_opts(sh, argc - 1, &argv[1], &opts);
+    if (err) {
+        return err;
+    }
+
+    // recording pauses for the replay, the trace is read straight from the ring
+    k_spinlock_key_t key = k_spin_lock(&capture.lock);
+    bool was_enabled = atomic_set(&capture.enabled, false);
+    struct replay_source src = {
+        .from_capture = true,
+        .capture = {.pos = capture.tail, .end = capture.head},
+    };
+    k_spin_unlock(&capture.lock, key);
+
+    err = replay_run(sh, &src, &opts);
+    cmd_ibl_capture_set(was_enabled);
+    return err;
+}
+
+#else
+
+#define IBL_REPLAY_CAPTURE_CMD
+
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    ibl_replay_cmds,
+    SHELL_CMD_ARG(gen, NULL,
+                  "Replay a synthetic trace: <circle|flick|jitter|scroll> <hz> <frames> "
+                  "[route <n>] [expect <crc>]",
+                  cmd_ibl_replay_gen, 4, 4),
+    IBL_REPLAY_CAPTURE_CMD SHELL_SUBCMD_SET_END);
+SHELL_SUBCMD_ADD((ibl), replay, &ibl_replay_cmds, "Run a trace through the listeners", NULL, 1,
+                 0);
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_BENCH)
+
+static inline void bench_add(struct zmk_input_behavior_bench_result *res, uint64_t ns) {
+    res->events++;
+    res->total_ns += ns;
+    res->max_ns = MAX(res->max_ns, ns);
+}
+
+int zmk_input_behavior_bench(const struct zmk_input_behavior_bench_run *run,
+                             struct zmk_input_behavior_bench_result *res) {
+    const struct input_behavior_listener_config *cfg = NULL;
+    for (uint8_t i = 0; i < ARRAY_SIZE(listener_configs); i++) {
+        if (!strcmp(listener_configs[i]->name, run->listener)) {
+            cfg = listener_configs[i];
+        }
+    }
+    uint8_t shape;
+    for (shape = 0; shape < ARRAY_SIZE(replay_shape_names); shape++) {
+        if (!strcmp(run->shape, replay_shape_names[shape])) {
+            break;
+        }
+    }
+    if (!cfg || shape == ARRAY_SIZE(replay_shape_names) || !run->clock || !run->hz ||
+        run->hz > 1000000) {
+        return -EINVAL;
+    }
+    const uint8_t b = run->binding;
+    if (run->stage == ZMK_INPUT_BEHAVIOR_BENCH_BINDING &&
+        (b >= cfg->bindings_count || !cfg->resolved[b].api)) {
+        return -ENOENT;
+    }
+
+    // the transform stage runs on a copy without bindings, so only the config steps are timed
+    struct input_behavior_listener_config transform = *cfg;
+    transform.bindings_count = 0;
+
+    *res = (struct zmk_input_behavior_bench_result){
+        .binding = run->stage == ZMK_INPUT_BEHAVIOR_BENCH_BINDING ? cfg->resolved[b].dev->name
+                                                                   : NULL,
+    };
+
+    struct replay_gen gen;
+    struct replay_event re;
+    uint64_t trace_us = 0;
+    replay_gen_init(&gen, shape, 0, run->hz, run->frames);
+
+    replay_begin();
+    int64_t start_us = k_ticks_to_us_floor64(k_uptime_ticks());
+
+    while (replay_gen_next(&gen, &re)) {
+        trace_us += re.delta_us;
+        k_sleep(K_TIMEOUT_ABS_US(start_us + trace_us));
+
+        struct input_event evt = re.evt;
+        evt.dev = cfg->dev;
+        uint64_t begin = run->clock();
+        intercept_with_input_config(&transform, &evt, IBL_SPEC_CFG_ARGS(&transform));
+        uint64_t ns = run->clock() - begin;
+
+        switch (run->stage) {
+        case ZMK_INPUT_BEHAVIOR_BENCH_TRANSFORM:
+            bench_add(res, ns);
+            break;
+        case ZMK_INPUT_BEHAVIOR_BENCH_BINDING:
+            begin = run->clock();
+            invoke_input_behavior(cfg, b, cfg->resolved[b].api, &evt, active_layer);
+            bench_add(res, run->clock() - begin);
+            break;
+        case ZMK_INPUT_BEHAVIOR_BENCH_SYNC:
+            handle_rel_code(cfg, cfg->data, &evt);
+            if (evt.sync) {
+                begin = run->clock();
+                sync_frame(cfg, cfg->data, false, cfg->rotate_deg, cfg->rotate_sin,
+                           cfg->rotate_cos);
+                bench_add(res, run->clock() - begin);
+            }
+            break;
+        }
+    }
+
+    replay_end();
+    return 0;
+}
+
+#endif
+
+static int input_behavior_listener_replay_keycode(const zmk_event_t *eh) {
+    const struct zmk_keycode_state_changed *ev = as_zmk_keycode_state_changed(eh);
+    if (!ev || !atomic_get(&replay.active)) {
+        return ZMK_EV_EVENT_BUBBLE;
+    }
+    uint8_t bytes[] = {ev->usage_page, ev->usage_page >> 8, ev->keycode, ev->keycode >> 8,
+                       ev->keycode >> 16, ev->keycode >> 24, ev->state};
+    replay.key_crc = crc32_ieee_update(replay.key_crc, bytes, sizeof(bytes));
+    if (ev->state) {
+        atomic_inc(&replay.keypresses);
+    }
+    return ZMK_EV_EVENT_BUBBLE;
+}
+
+ZMK_LISTENER(input_behavior_listener_replay, input_behavior_listener_replay_keycode);
+ZMK_SUBSCRIPTION(input_behavior_listener_replay, zmk_keycode_state_changed);
+
+#endif
+
+SHELL_SUBCMD_SET_CREATE(ibl_cmds, (ibl));
+SHELL_CMD_REGISTER(ibl, &ibl_cmds, "Input behavior listener diagnostics", NULL);
+
+#endif
+
+#endif // VALID_LISTENER_COUNT > 0
 
 // #endif /* DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT) */
@@ -6,6 +6,7 @@
 
 #define DT_DRV_COMPAT zmk_input_behavior_move_to_keypress
 
+#include <stdlib.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <drivers/behavior.h>
@@ -13,11 +14,17 @@
 #include <zephyr/dt-bindings/input/input-event-codes.h>
 #include <zephyr/sys/util.h>
 
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+#include <zephyr/shell/shell.h>
+#include <zephyr/stats/stats.h>
+#endif
+
 #include <zephyr/logging/log.h>
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #include <zmk/keymap.h>
 #include <zmk/behavior.h>
+#include <zmk/input_behavior.h>
 #include <zmk/event_manager.h>
 #include <zmk/events/layer_state_changed.h>
 
@@ -28,178 +35,282 @@ enum move_to_keypress_xy_data_mode {
     IB_MOVE_TO_KEYPRESS_XY_DATA_MODE_REL,
 };
 
+enum move_to_keypress_direction {
+    IB_MOVE_TO_KEYPRESS_RIGHT,
+    IB_MOVE_TO_KEYPRESS_LEFT,
+    IB_MOVE_TO_KEYPRESS_UP,
+    IB_MOVE_TO_KEYPRESS_DOWN,
+};
+
+// Taps waiting for the work item, a flick crossing several thresholds queues one per crossing.
+#define MOVE_TO_KEYPRESS_QUEUE_LEN 16
+BUILD_ASSERT(IS_POWER_OF_TWO(MOVE_TO_KEYPRESS_QUEUE_LEN), "Queue length must be a power of two");
+
 struct move_to_keypress_xy_data {
     enum move_to_keypress_xy_data_mode mode;
-    int16_t x_delta;
-    int16_t y_delta;
+    int32_t x_delta;
+    int32_t y_delta;
 };
 
+struct move_to_keypress_tap {
+    uint8_t direction;
+    uint8_t layer;
+    uint16_t gap_ms;
+};
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS) && IS_ENABLED(CONFIG_STATS)
+
+STATS_SECT_START(ibl_m2k)
+STATS_SECT_ENTRY32(taps)
+STATS_SECT_ENTRY32(dropped)
+STATS_SECT_END;
+
+STATS_NAME_START(ibl_m2k)
+STATS_NAME(ibl_m2k, taps)
+STATS_NAME(ibl_m2k, dropped)
+STATS_NAME_END(ibl_m2k);
+
+#define MOVE_TO_KEYPRESS_STATS_INC(data, field) STATS_INC((data)->stats, field)
+#else
+#define MOVE_TO_KEYPRESS_STATS_INC(data, field)
+#endif
+
 struct behavior_move_to_keypress_data {
     const struct device *dev;
     struct move_to_keypress_xy_data data;
-    
-    struct k_work_delayable key_press_work;
-    struct k_work_delayable key_release_work;
-    
-    struct zmk_behavior_binding current_binding;
-    struct zmk_behavior_binding_event current_event;
-    
-    int64_t last_trigger_time;
-    bool work_scheduled;
-    uint8_t active_layer;
+    struct zmk_input_behavior_velocity velocity;
+
+    // filled by the input path, drained by tap_work; the ring is the only state they share
+    struct zmk_input_behavior_spsc queue;
+    struct move_to_keypress_tap taps[MOVE_TO_KEYPRESS_QUEUE_LEN];
+    atomic_t dropped;
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+    atomic_t queued;
+#if IS_ENABLED(CONFIG_STATS)
+    STATS_SECT_DECL(ibl_m2k) stats;
+#endif
+#endif
+
+    // owned by tap_work
+    struct k_work_delayable tap_work;
+    struct move_to_keypress_tap pressed;
+    bool tap_pressed;
+    // uptime at which the gap after the last release ends, read by the input path
+    atomic_t gap_end_ms;
+
+    // resolved lazily from the tap work, all keymap behaviors are ready by then
+    const struct device *behaviors[4];
 };
 
 struct behavior_move_to_keypress_config {
-    int16_t threshold;
-    int16_t x_threshold;
-    int16_t y_threshold;
+    int32_t threshold;
+    int32_t x_threshold;
+    int32_t y_threshold;
     int16_t rate_limit_ms;
+    uint16_t tap_ms;
+    uint16_t tap_gap_ms;
     bool x_invert;
     bool y_invert;
     bool reset_other_axis;
+    // (counts per second, gain percent) pairs, see velocity_gain()
+    const int32_t *velocity_curve;
+    uint8_t velocity_curve_len;
     struct zmk_behavior_binding bindings[4]; // RIGHT, LEFT, UP, DOWN
 };
 
 static void handle_rel_code(const struct behavior_move_to_keypress_config *config,
-                            struct behavior_move_to_keypress_data *data, 
-                            struct input_event *evt) {
-    switch (evt->code) {
+                            struct behavior_move_to_keypress_data *data, uint16_t code,
+                            int32_t value) {
+    switch (code) {
     case INPUT_REL_X:
         data->data.mode = IB_MOVE_TO_KEYPRESS_XY_DATA_MODE_REL;
-        int16_t x_val = config->x_invert ? -evt->value : evt->value;
+        int32_t x_val = config->x_invert ? -value : value;
         data->data.x_delta += x_val;
         break;
     case INPUT_REL_Y:
         data->data.mode = IB_MOVE_TO_KEYPRESS_XY_DATA_MODE_REL;
-        int16_t y_val = config->y_invert ? -evt->value : evt->value;
+        int32_t y_val = config->y_invert ? -value : value;
         data->data.y_delta += y_val;
         break;
     default:
         break;
     }
     
-    const int16_t x_max_delta = config->x_threshold * 3;
-    const int16_t y_max_delta = config->y_threshold * 3;
+    const int32_t x_max_delta = config->x_threshold * 3;
+    const int32_t y_max_delta = config->y_threshold * 3;
     data->data.x_delta = CLAMP(data->data.x_delta, -x_max_delta, x_max_delta);
     data->data.y_delta = CLAMP(data->data.y_delta, -y_max_delta, y_max_delta);
 }
 
-static void key_press_work_cb(struct k_work *work) {
-    struct k_work_delayable *work_delayable = (struct k_work_delayable *)work;
-    struct behavior_move_to_keypress_data *data = CONTAINER_OF(work_delayable,
-                                                              struct behavior_move_to_keypress_data,
-                                                              key_press_work);
-    
-    if (!zmk_keymap_layer_active(data->active_layer)) {
-        data->work_scheduled = false;
-        return;
+/*
+ * Gain in percent for the current ball speed. Thresholds and tap gaps are divided by it, so a
+ * fast roll crosses thresholds more often and its taps go out faster, while slow motion keeps
+ * the configured precision.
+ */
+static uint32_t velocity_gain(const struct behavior_move_to_keypress_config *config,
+                              struct behavior_move_to_keypress_data *data) {
+    if (!config->velocity_curve_len) {
+        return 100;
     }
-    
-    const struct device *behavior = zmk_behavior_get_binding(data->current_binding.behavior_dev);
+    int32_t gain = zmk_input_behavior_curve_eval(config->velocity_curve, config->velocity_curve_len,
+                                                 (int32_t)MIN(data->velocity.speed, INT32_MAX));
+    return MAX(gain, 1);
+}
+
+static const struct device *
+resolve_direction(struct behavior_move_to_keypress_data *data,
+                  const struct behavior_move_to_keypress_config *config, uint8_t direction) {
+    const struct device *behavior = data->behaviors[direction];
     if (!behavior) {
-        data->work_scheduled = false;
-        return;
+        behavior = zmk_behavior_get_binding(config->bindings[direction].behavior_dev);
+        if (!behavior) {
+            LOG_WRN("No behavior %s assigned to %s", config->bindings[direction].behavior_dev,
+                    data->dev->name);
+            return NULL;
+        }
+        data->behaviors[direction] = behavior;
     }
-    
+    return behavior;
+}
+
+static void invoke_tap(struct behavior_move_to_keypress_data *data,
+                       const struct behavior_move_to_keypress_config *config,
+                       const struct device *behavior, const struct move_to_keypress_tap *tap,
+                       bool pressed) {
     const struct behavior_driver_api *api = behavior->api;
-    if (!api || !api->binding_pressed) {
-        data->work_scheduled = false;
-        return;
+    struct zmk_behavior_binding binding = config->bindings[tap->direction];
+    struct zmk_behavior_binding_event event = {
+        .layer = tap->layer,
+        .timestamp = k_uptime_get(),
+    };
+
+    if (pressed && api->binding_pressed) {
+        api->binding_pressed(&binding, event);
+    } else if (!pressed && api->binding_released) {
+        api->binding_released(&binding, event);
     }
-    
-    api->binding_pressed(&data->current_binding, data->current_event);
 }
 
-static void key_release_work_cb(struct k_work *work) {
+/*
+ * Single work item stepping through the queue: press the head, release it tap-ms later, then
+ * wait tap-gap-ms before the next one. Only this callback reads the queue, so a tap is never
+ * rewritten while it is being sent.
+ */
+static void tap_work_cb(struct k_work *work) {
     struct k_work_delayable *work_delayable = (struct k_work_delayable *)work;
     struct behavior_move_to_keypress_data *data = CONTAINER_OF(work_delayable,
                                                               struct behavior_move_to_keypress_data,
-                                                              key_release_work);
-    
-    if (!zmk_keymap_layer_active(data->active_layer)) {
-        data->work_scheduled = false;
-        return;
+                                                              tap_work);
+    const struct behavior_move_to_keypress_config *config = data->dev->config;
+
+    if (data->tap_pressed) {
+        // the press went out, so the release always follows even if the layer is gone
+        invoke_tap(data, config, data->behaviors[data->pressed.direction], &data->pressed, false);
+        data->tap_pressed = false;
+        atomic_set(&data->gap_end_ms, (atomic_val_t)(k_uptime_get_32() + data->pressed.gap_ms));
+        if (data->pressed.gap_ms && !zmk_input_behavior_spsc_empty(&data->queue)) {
+            k_work_schedule(work_delayable, K_MSEC(data->pressed.gap_ms));
+            return;
+        }
     }
-    
-    const struct device *behavior = zmk_behavior_get_binding(data->current_binding.behavior_dev);
-    if (!behavior) {
-        data->work_scheduled = false;
+
+    while (!zmk_input_behavior_spsc_empty(&data->queue)) {
+        uint32_t idx =
+            zmk_input_behavior_spsc_consume_idx(&data->queue, MOVE_TO_KEYPRESS_QUEUE_LEN);
+        struct move_to_keypress_tap tap = data->taps[idx];
+        zmk_input_behavior_spsc_consume_release(&data->queue);
+
+        if (!zmk_keymap_layer_active(tap.layer)) {
+            continue;
+        }
+        const struct device *behavior = resolve_direction(data, config, tap.direction);
+        if (!behavior) {
+            continue;
+        }
+
+        invoke_tap(data, config, behavior, &tap, true);
+        data->pressed = tap;
+        data->tap_pressed = true;
+        k_work_schedule(work_delayable, K_MSEC(config->tap_ms));
         return;
     }
-    
-    const struct behavior_driver_api *api = behavior->api;
-    if (api && api->binding_released) {
-        api->binding_released(&data->current_binding, data->current_event);
+}
+
+static void queue_tap(struct behavior_move_to_keypress_data *data, uint8_t direction,
+                      uint8_t layer, uint16_t gap_ms) {
+    if (zmk_input_behavior_spsc_full(&data->queue, MOVE_TO_KEYPRESS_QUEUE_LEN)) {
+        atomic_inc(&data->dropped);
+        MOVE_TO_KEYPRESS_STATS_INC(data, dropped);
+        LOG_DBG("%s tap queue full, %ld taps dropped", data->dev->name,
+                (long)atomic_get(&data->dropped));
+        return;
     }
-    
-    data->work_scheduled = false;
+    uint32_t idx = zmk_input_behavior_spsc_produce_idx(&data->queue, MOVE_TO_KEYPRESS_QUEUE_LEN);
+    data->taps[idx] =
+        (struct move_to_keypress_tap){.direction = direction, .layer = layer, .gap_ms = gap_ms};
+    zmk_input_behavior_spsc_produce_commit(&data->queue);
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS)
+    atomic_inc(&data->queued);
+    MOVE_TO_KEYPRESS_STATS_INC(data, taps);
+#endif
 }
 
+// Queues one tap per threshold the accumulated deltas cross, x before y as before.
 static void check_and_schedule_movements(const struct behavior_move_to_keypress_config *config,
                                         struct behavior_move_to_keypress_data *data,
-                                        struct zmk_behavior_binding_event original_event) {
-    bool movement_triggered = false;
+                                        uint8_t layer) {
+    bool x_triggered = false;
+    bool y_triggered = false;
+
+    uint32_t gain = velocity_gain(config, data);
+    int32_t x_threshold = MAX(config->x_threshold * 100 / gain, 1);
+    int32_t y_threshold = MAX(config->y_threshold * 100 / gain, 1);
+    uint16_t gap_ms = config->tap_gap_ms * 100 / gain;
     
-    if (data->data.x_delta >= config->x_threshold) {
-        data->current_binding = config->bindings[0];
-        data->current_event = original_event;
-        data->data.x_delta -= config->x_threshold;
-        movement_triggered = true;
-        
-        if (config->reset_other_axis) {
-            data->data.y_delta = 0;
-        }
-        
-    } else if (data->data.x_delta <= -config->x_threshold) {
-        data->current_binding = config->bindings[1];
-        data->current_event = original_event;
-        data->data.x_delta += config->x_threshold;
-        movement_triggered = true;
-        
-        if (config->reset_other_axis) {
-            data->data.y_delta = 0;
-        }
+    while (data->data.x_delta >= x_threshold) {
+        data->data.x_delta -= x_threshold;
+        queue_tap(data, IB_MOVE_TO_KEYPRESS_RIGHT, layer, gap_ms);
+        x_triggered = true;
+    }
+    while (data->data.x_delta <= -x_threshold) {
+        data->data.x_delta += x_threshold;
+        queue_tap(data, IB_MOVE_TO_KEYPRESS_LEFT, layer, gap_ms);
+        x_triggered = true;
     }
     
-    if (!movement_triggered) {
-        if (data->data.y_delta >= config->y_threshold) {
-            data->current_binding = config->bindings[3];
-            data->current_event = original_event;
-            data->data.y_delta -= config->y_threshold;
-            movement_triggered = true;
-            
-            if (config->reset_other_axis) {
-                data->data.x_delta = 0;
-            }
-            
-        } else if (data->data.y_delta <= -config->y_threshold) {
-            data->current_binding = config->bindings[2];
-            data->current_event = original_event;
-            data->data.y_delta += config->y_threshold;
-            movement_triggered = true;
-            
-            if (config->reset_other_axis) {
-                data->data.x_delta = 0;
-            }
+    if (x_triggered && config->reset_other_axis) {
+        data->data.y_delta = 0;
+    } else {
+        while (data->data.y_delta >= y_threshold) {
+            data->data.y_delta -= y_threshold;
+            queue_tap(data, IB_MOVE_TO_KEYPRESS_DOWN, layer, gap_ms);
+            y_triggered = true;
+        }
+        while (data->data.y_delta <= -y_threshold) {
+            data->data.y_delta += y_threshold;
+            queue_tap(data, IB_MOVE_TO_KEYPRESS_UP, layer, gap_ms);
+            y_triggered = true;
+        }
+        if (y_triggered && config->reset_other_axis) {
+            data->data.x_delta = 0;
         }
     }
     
-    if (movement_triggered && !data->work_scheduled) {
-        data->work_scheduled = true;
-        data->last_trigger_time = k_uptime_get();
-        
-        k_work_schedule(&data->key_press_work, K_MSEC(0));
-        k_work_schedule(&data->key_release_work, K_MSEC(10));
+    if (x_triggered || y_triggered) {
+        // no-op while a press or gap is pending, the callback picks up the new taps itself;
+        // a queue that ran dry still owes the rest of the gap after its last release
+        int32_t wait = (int32_t)((uint32_t)atomic_get(&data->gap_end_ms) - k_uptime_get_32());
+        k_work_schedule(&data->tap_work, wait > 0 ? K_MSEC(wait) : K_NO_WAIT);
     }
 }
 
 static int move_to_keypress_keymap_binding_pressed(struct zmk_behavior_binding *binding,
                                                   struct zmk_behavior_binding_event event) {
-    const struct device *dev = zmk_behavior_get_binding(binding->behavior_dev);
+    const struct device *dev = zmk_input_behavior_binding_dev(binding);
     struct behavior_move_to_keypress_data *data = dev->data;
     const struct behavior_move_to_keypress_config *config = dev->config;
     
-    struct input_event *evt = (struct input_event *)event.position;
+    struct input_event *evt = (struct input_event *)(uintptr_t)event.position;
     
     if (evt->type != INPUT_EV_REL) {
         return ZMK_BEHAVIOR_TRANSPARENT;
@@ -208,18 +319,12 @@ static int move_to_keypress_keymap_binding_pressed(struct zmk_behavior_binding *
         return ZMK_BEHAVIOR_TRANSPARENT;
     }
     
-    int64_t current_time = k_uptime_get();
-    if (current_time - data->last_trigger_time < config->rate_limit_ms) {
-        evt->value = 0;
-        return ZMK_BEHAVIOR_OPAQUE;
-    }
-    
-    data->active_layer = event.layer;
-    
-    handle_rel_code(config, data, evt);
+    handle_rel_code(config, data, evt->code, evt->value);
+    zmk_input_behavior_velocity_update(&data->velocity, (uint32_t)abs(evt->value),
+                                       (uint32_t)event.timestamp);
     
     if (data->data.mode == IB_MOVE_TO_KEYPRESS_XY_DATA_MODE_REL) {
-        check_and_schedule_movements(config, data, event);
+        check_and_schedule_movements(config, data, event.layer);
         
         evt->value = 0;
         return ZMK_BEHAVIOR_OPAQUE;
@@ -228,6 +333,47 @@ static int move_to_keypress_keymap_binding_pressed(struct zmk_behavior_binding *
     return ZMK_BEHAVIOR_TRANSPARENT;
 }
 
+static int move_to_keypress_frame_process(const struct device *dev,
+                                          struct zmk_behavior_binding *binding,
+                                          struct zmk_input_behavior_frame *frame) {
+    struct behavior_move_to_keypress_data *data = dev->data;
+    const struct behavior_move_to_keypress_config *config = dev->config;
+
+    if (!frame->x && !frame->y) {
+        return ZMK_BEHAVIOR_TRANSPARENT;
+    }
+
+    // the pointer motion is consumed, scroll and buttons pass through
+    handle_rel_code(config, data, INPUT_REL_X, frame->x);
+    handle_rel_code(config, data, INPUT_REL_Y, frame->y);
+    zmk_input_behavior_velocity_update(&data->velocity, (uint32_t)(abs(frame->x) + abs(frame->y)),
+                                       (uint32_t)frame->timestamp);
+    check_and_schedule_movements(config, data, frame->layer);
+
+    frame->x = frame->y = 0;
+    return ZMK_BEHAVIOR_TRANSPARENT;
+}
+
+static void move_to_keypress_reset(const struct device *dev) {
+    struct behavior_move_to_keypress_data *data = dev->data;
+    const struct behavior_move_to_keypress_config *config = dev->config;
+    struct k_work_sync sync;
+
+    k_work_cancel_delayable_sync(&data->tap_work, &sync);
+    if (data->tap_pressed) {
+        // never leave a key held
+        invoke_tap(data, config, data->behaviors[data->pressed.direction], &data->pressed, false);
+        data->tap_pressed = false;
+    }
+    // the tap work is the consumer and is stopped, so the queue can be emptied from here
+    atomic_set(&data->queue.tail, atomic_get(&data->queue.head));
+    atomic_clear(&data->gap_end_ms);
+    data->data.mode = IB_MOVE_TO_KEYPRESS_XY_DATA_MODE_NONE;
+    data->data.x_delta = 0;
+    data->data.y_delta = 0;
+    data->velocity = (struct zmk_input_behavior_velocity){0};
+}
+
 static int move_to_keypress_layer_listener(const zmk_event_t *eh) {
     return ZMK_EV_EVENT_BUBBLE;
 }
@@ -238,13 +384,14 @@ static int input_behavior_move_to_keypress_init(const struct device *dev) {
     data->data.mode = IB_MOVE_TO_KEYPRESS_XY_DATA_MODE_NONE;
     data->data.x_delta = 0;
     data->data.y_delta = 0;
-    data->last_trigger_time = 0;
-    data->work_scheduled = false;
-    data->active_layer = 0;
-    
-    k_work_init_delayable(&data->key_press_work, key_press_work_cb);
-    k_work_init_delayable(&data->key_release_work, key_release_work_cb);
     
+    k_work_init_delayable(&data->tap_work, tap_work_cb);
+
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS) && IS_ENABLED(CONFIG_STATS)
+    stats_init_and_reg(STATS_HDR(data->stats), STATS_SIZE_INIT_PARMS(data->stats, STATS_SIZE_32),
+                       STATS_NAME_INIT_PARMS(ibl_m2k), dev->name);
+#endif
+
     return 0;
 }
 
@@ -261,16 +408,32 @@ static const struct behavior_driver_api behavior_move_to_keypress_driver_api = {
                              (DT_PHA_BY_IDX(node_id, bindings, idx, param2)), (0)), \
     }
 
+// rate-limit-ms spaces tap starts, the gap after a release is what is left of it
+#define MOVE_TO_KEYPRESS_DEFAULT_GAP(n)                                                     \
+    MAX(DT_INST_PROP_OR(n, rate_limit_ms, 50) - DT_INST_PROP(n, tap_ms), 0)
+
+#define MOVE_TO_KEYPRESS_CURVE_DEFINE(n)                                                    \
+    COND_CODE_1(DT_INST_NODE_HAS_PROP(n, velocity_curve),                                   \
+                (static const int32_t move_to_keypress_curve_##n[] =                        \
+                     DT_INST_PROP(n, velocity_curve);),                                     \
+                ())
+
 #define MTKLP_INST(n)                                                                       \
+    MOVE_TO_KEYPRESS_CURVE_DEFINE(n)                                                        \
     static struct behavior_move_to_keypress_data behavior_move_to_keypress_data_##n = {};   \
     static struct behavior_move_to_keypress_config behavior_move_to_keypress_config_##n = { \
         .threshold = DT_INST_PROP(n, threshold),                                            \
         .x_threshold = DT_INST_PROP_OR(n, x_threshold, DT_INST_PROP(n, threshold)),         \
         .y_threshold = DT_INST_PROP_OR(n, y_threshold, DT_INST_PROP(n, threshold)),         \
         .rate_limit_ms = DT_INST_PROP_OR(n, rate_limit_ms, 50),                             \
+        .tap_ms = DT_INST_PROP(n, tap_ms),                                                  \
+        .tap_gap_ms = DT_INST_PROP_OR(n, tap_gap_ms, MOVE_TO_KEYPRESS_DEFAULT_GAP(n)),      \
         .x_invert = DT_INST_PROP_OR(n, x_invert, false),                                    \
         .y_invert = DT_INST_PROP_OR(n, y_invert, false),                                    \
         .reset_other_axis = DT_INST_PROP_OR(n, reset_other_axis, false),                    \
+        .velocity_curve = COND_CODE_1(DT_INST_NODE_HAS_PROP(n, velocity_curve),             \
+                                      (move_to_keypress_curve_##n), (NULL)),                \
+        .velocity_curve_len = DT_INST_PROP_LEN_OR(n, velocity_curve, 0),                    \
         .bindings = {                                                                       \
             MOVE_TO_KEYPRESS_BINDING(0, DT_DRV_INST(n)), /* RIGHT */                       \
             MOVE_TO_KEYPRESS_BINDING(1, DT_DRV_INST(n)), /* LEFT */                        \
@@ -282,10 +445,33 @@ static const struct behavior_driver_api behavior_move_to_keypress_driver_api = {
                             &behavior_move_to_keypress_data_##n,                            \
                             &behavior_move_to_keypress_config_##n,                          \
                             POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,               \
-                            &behavior_move_to_keypress_driver_api);
+                            &behavior_move_to_keypress_driver_api);                 \
+    ZMK_INPUT_BEHAVIOR_FRAME_API_DT_INST_DEFINE(n, move_to_keypress_frame_process)          \
+    ZMK_INPUT_BEHAVIOR_STATE_API_DT_INST_DEFINE(n, move_to_keypress_reset)
 
 DT_INST_FOREACH_STATUS_OKAY(MTKLP_INST)
 
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_STATS) && IS_ENABLED(CONFIG_SHELL)
+
+#define MOVE_TO_KEYPRESS_DATA_REF(n) &behavior_move_to_keypress_data_##n,
+
+static struct behavior_move_to_keypress_data *const move_to_keypress_instances[] = {
+    DT_INST_FOREACH_STATUS_OKAY(MOVE_TO_KEYPRESS_DATA_REF)};
+
+static int cmd_ibl_m2k(const struct shell *sh, size_t argc, char **argv) {
+    for (uint8_t i = 0; i < ARRAY_SIZE(move_to_keypress_instances); i++) {
+        struct behavior_move_to_keypress_data *data = move_to_keypress_instances[i];
+        shell_print(sh, "%s: taps %ld dropped %ld pending %ld", data->dev->name,
+                    (long)atomic_get(&data->queued), (long)atomic_get(&data->dropped),
+                    (long)(atomic_get(&data->queue.head) - atomic_get(&data->queue.tail)));
+    }
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((ibl), m2k, NULL, "Show move-to-keypress tap counters", cmd_ibl_m2k, 1, 0);
+
+#endif
+
 ZMK_LISTENER(move_to_keypress_layer, move_to_keypress_layer_listener);
 ZMK_SUBSCRIPTION(move_to_keypress_layer, zmk_layer_state_changed);
 
@@ -6,6 +6,8 @@
 
 #define DT_DRV_COMPAT zmk_input_behavior_scaler
 
+#include <stdlib.h>
+#include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <drivers/behavior.h>
@@ -17,6 +19,7 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #include <zmk/keymap.h>
 #include <zmk/behavior.h>
+#include <zmk/input_behavior.h>
 
 #if IS_ENABLED(CONFIG_ZMK_HID_IO)
 #include <zmk/hid-io/endpoints.h>
@@ -25,102 +28,159 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 // #if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
 
-enum scaler_xy_data_mode {
-    IB_SCALER_XY_DATA_MODE_NONE,
-    IB_SCALER_XY_DATA_MODE_REL,
-    IB_SCALER_XY_DATA_MODE_ABS,
-};
+// Relative codes get an accumulator each, indexed by code.
+#define SCALER_CODES (INPUT_REL_MISC + 1)
 
-struct scaler_xy_data {
-    enum scaler_xy_data_mode mode;
-    int16_t delta;
+/*
+ * Accumulators count in units of 1/div, so the remainder of every division is kept exactly
+ * and scaling never drifts. Every listener binding of a scaler node gets its own ratio slot,
+ * reciprocal and accumulators, taken from devicetree at build time, so bindings with different
+ * ratios on one node no longer reset each other. Bindings with the same ratio share a slot.
+ */
+struct scaler_ratio {
+    int32_t mul;
+    uint32_t div;
+    // floor((2^32 - 1) / div), the quotient estimate is short by at most one
+    uint32_t recip_q32;
 };
 
+#define SCALER_RATIO(m, d)                                                                  \
+    {.mul = (m), .div = MAX((d), 1), .recip_q32 = UINT32_MAX / MAX((d), 1)}
+
 struct behavior_scaler_data {
     const struct device *dev;
-    struct scaler_xy_data data;
+    // one row per devicetree ratio, the last one belongs to the spare slot
+    int32_t (*acc)[SCALER_CODES];
+    // ratio of bindings that are not in any listener, recomputed when it changes
+    struct scaler_ratio spare;
 };
 
 struct behavior_scaler_config {
     int8_t evt_type;
+    // -1 matches no code
     int8_t input_code;
+    // every relative code, each against its own accumulator
+    bool all_input_codes;
+    uint8_t ratios_len;
+    const struct scaler_ratio *ratios;
 };
 
-static void handle_rel_code(const struct behavior_scaler_config *config,
-                            struct behavior_scaler_data *data, struct input_event *evt) {
-    switch (evt->code) {
-    case INPUT_REL_X:
-    case INPUT_REL_Y:
-    case INPUT_REL_WHEEL:
-    case INPUT_REL_HWHEEL:
-    case INPUT_REL_MISC:
-        data->data.mode = IB_SCALER_XY_DATA_MODE_REL;
-        data->data.delta += evt->value;
-        break;
-    default:
-        break;
+static int32_t *scaler_slot(const struct behavior_scaler_config *config,
+                            struct behavior_scaler_data *data, int32_t mul, uint32_t div,
+                            const struct scaler_ratio **ratio) {
+    for (uint8_t i = 0; i < config->ratios_len; i++) {
+        if (config->ratios[i].mul == mul && config->ratios[i].div == div) {
+            *ratio = &config->ratios[i];
+            return data->acc[i];
+        }
+    }
+    if (data->spare.mul != mul || data->spare.div != div) {
+        // the spare remainders are in units of the old ratio
+        memset(data->acc[config->ratios_len], 0, sizeof(data->acc[0]));
+        data->spare = (struct scaler_ratio)SCALER_RATIO(mul, div);
+    }
+    *ratio = &data->spare;
+    return data->acc[config->ratios_len];
+}
+
+// Returns the whole units in acc, truncated toward zero, and leaves the exact remainder in acc.
+static int32_t scaler_take(const struct scaler_ratio *ratio, int32_t *acc) {
+    uint32_t mag = (uint32_t)abs(*acc);
+    uint32_t q = (uint32_t)(((uint64_t)mag * ratio->recip_q32) >> 32);
+    uint32_t r = mag - q * ratio->div;
+    // mag stays below 2^31, so the reciprocal rounding costs less than one unit
+    if (r >= ratio->div) {
+        q++;
+        r -= ratio->div;
     }
+    int32_t out = (*acc < 0) ? -(int32_t)q : (int32_t)q;
+    *acc = (*acc < 0) ? -(int32_t)r : (int32_t)r;
+    return out;
+}
+
+static inline bool scaler_accepts_code(const struct behavior_scaler_config *config,
+                                       uint16_t code) {
+    return code < SCALER_CODES && (config->all_input_codes || code == config->input_code);
 }
 
-static void handle_abs_code(const struct behavior_scaler_config *config,
-                            struct behavior_scaler_data *data, struct input_event *evt) {
+// Scales value in place, opaque while it has not added up to a whole unit yet.
+static int scale_rel_value(struct zmk_behavior_binding *binding,
+                           const struct behavior_scaler_config *config,
+                           struct behavior_scaler_data *data, uint16_t code, int32_t *value) {
+    int32_t mul = binding->param1;
+    if (!mul) {
+        *value = 0;
+        // LOG_DBG("Suu~~~!");
+        return ZMK_BEHAVIOR_OPAQUE;
+    }
+    const struct scaler_ratio *ratio;
+    int32_t *acc = &scaler_slot(config, data, mul, MAX(binding->param2, 1), &ratio)[code];
+    *acc = (int32_t)CLAMP((int64_t)*acc + (int64_t)*value * mul, INT32_MIN + 1, INT32_MAX);
+    int32_t sval = scaler_take(ratio, acc);
+    // LOG_DBG("* %d / %d > %d => %d", mul, ratio->div, *value, sval);
+    if (sval) {
+        *value = sval;
+        return ZMK_BEHAVIOR_TRANSPARENT;
+    } else {
+        return ZMK_BEHAVIOR_OPAQUE;
+    }
 }
 
 static int scaler_keymap_binding_pressed(struct zmk_behavior_binding *binding,
                                          struct zmk_behavior_binding_event event) {
 
-    const struct device *dev = zmk_behavior_get_binding(binding->behavior_dev);
+    const struct device *dev = zmk_input_behavior_binding_dev(binding);
     struct behavior_scaler_data *data = 
         (struct behavior_scaler_data *)dev->data;
     const struct behavior_scaler_config *config = dev->config;
     
-    struct input_event *evt = (struct input_event *)event.position;
-    if (evt->type != config->evt_type) {
+    struct input_event *evt = (struct input_event *)(uintptr_t)event.position;
+    if (evt->type != config->evt_type || evt->type != INPUT_EV_REL) {
         return ZMK_BEHAVIOR_TRANSPARENT;
     }
-    if (evt->code != config->input_code) {
+    if (!scaler_accepts_code(config, evt->code)) {
         return ZMK_BEHAVIOR_TRANSPARENT;
     }
     if (!evt->value) {
         return ZMK_BEHAVIOR_TRANSPARENT;
     }
 
-    switch (evt->type) {
-    case INPUT_EV_REL:
-        handle_rel_code(config, data, evt);
-        break;
-    case INPUT_EV_ABS:
-        handle_abs_code(config, data, evt);
-        break;
-    default:
+    return scale_rel_value(binding, config, data, evt->code, &evt->value);
+}
+
+static const uint16_t scaler_frame_codes[] = {INPUT_REL_X, INPUT_REL_Y, INPUT_REL_WHEEL,
+                                              INPUT_REL_HWHEEL};
+
+static int scaler_frame_process(const struct device *dev, struct zmk_behavior_binding *binding,
+                                struct zmk_input_behavior_frame *frame) {
+    struct behavior_scaler_data *data = dev->data;
+    const struct behavior_scaler_config *config = dev->config;
+
+    if (config->evt_type != INPUT_EV_REL) {
         return ZMK_BEHAVIOR_TRANSPARENT;
     }
 
-    if (data->data.mode == IB_SCALER_XY_DATA_MODE_REL) {
-        int16_t mul = binding->param1;
-        if (!mul) {
-            evt->value = 0;
-            // LOG_DBG("Suu~~~!");
-            return ZMK_BEHAVIOR_OPAQUE;
+    for (uint8_t i = 0; i < ARRAY_SIZE(scaler_frame_codes); i++) {
+        uint16_t code = scaler_frame_codes[i];
+        int32_t *value = zmk_input_behavior_frame_field(frame, code);
+        if (!scaler_accepts_code(config, code) || !*value) {
+            continue;
         }
-        int16_t div = binding->param2;
-        int16_t delta = data->data.delta;
-        int16_t sval = delta * mul / div;
-        // LOG_DBG("* %d / %d > delta: %d => %d", mul, div, delta, sval);
-        if (sval) {
-            data->data.mode = IB_SCALER_XY_DATA_MODE_NONE;
-            data->data.delta = 0;
-            evt->value = sval;
-            // LOG_DBG("* %d / %d > delta: %d => %d", mul, div, delta, sval);
-            return ZMK_BEHAVIOR_TRANSPARENT;
-        } else {
-            return ZMK_BEHAVIOR_OPAQUE;
+        // only the scaled field is held back, the rest of the frame carries on
+        if (scale_rel_value(binding, config, data, code, value) == ZMK_BEHAVIOR_OPAQUE) {
+            *value = 0;
         }
     }
-
     return ZMK_BEHAVIOR_TRANSPARENT;
 }
 
+static void scaler_reset(const struct device *dev) {
+    struct behavior_scaler_data *data = dev->data;
+    const struct behavior_scaler_config *config = dev->config;
+    memset(data->acc, 0, (config->ratios_len + 1) * sizeof(data->acc[0]));
+    data->spare = (struct scaler_ratio){0};
+}
+
 static int input_behavior_to_init(const struct device *dev) {
     struct behavior_scaler_data *data = dev->data;
     data->dev = dev;
@@ -131,17 +191,39 @@ static const struct behavior_driver_api behavior_scaler_driver_api = {
     .binding_pressed = scaler_keymap_binding_pressed,
 };
 
+// Ratio of every listener binding that points at scaler instance inst.
+#define SCALER_BINDING_RATIO(node_id, prop, idx, inst)                                      \
+    IF_ENABLED(DT_SAME_NODE(DT_PHANDLE_BY_IDX(node_id, prop, idx), DT_DRV_INST(inst)),       \
+               (SCALER_RATIO(DT_PHA_BY_IDX_OR(node_id, prop, idx, param1, 0),               \
+                             DT_PHA_BY_IDX_OR(node_id, prop, idx, param2, 1)), ))
+
+#define SCALER_LISTENER_RATIOS(node_id, inst)                                               \
+    IF_ENABLED(DT_NODE_HAS_PROP(node_id, bindings),                                         \
+               (DT_FOREACH_PROP_ELEM_VARGS(node_id, bindings, SCALER_BINDING_RATIO, inst)))
+
 #define IBSLR_INST(n)                                                                       \
-    static struct behavior_scaler_data behavior_scaler_data_##n = {};                       \
+    static const struct scaler_ratio behavior_scaler_ratios_##n[] = {                       \
+        DT_FOREACH_STATUS_OKAY_VARGS(zmk_input_behavior_listener, SCALER_LISTENER_RATIOS,   \
+                                     n)};                                                   \
+    static int32_t behavior_scaler_acc_##n[ARRAY_SIZE(behavior_scaler_ratios_##n) + 1]      \
+                                          [SCALER_CODES];                                   \
+    static struct behavior_scaler_data behavior_scaler_data_##n = {                         \
+        .acc = behavior_scaler_acc_##n,                                                     \
+    };                                                                                      \
     static struct behavior_scaler_config behavior_scaler_config_##n = {                     \
         .evt_type = DT_INST_PROP(n, evt_type),                                              \
         .input_code = DT_INST_PROP(n, input_code),                                          \
+        .all_input_codes = DT_INST_PROP(n, all_input_codes),                                \
+        .ratios_len = ARRAY_SIZE(behavior_scaler_ratios_##n),                               \
+        .ratios = behavior_scaler_ratios_##n,                                               \
     };                                                                                      \
     BEHAVIOR_DT_INST_DEFINE(n, input_behavior_to_init, NULL,                                \
                             &behavior_scaler_data_##n,                                      \
                             &behavior_scaler_config_##n,                                    \
                             POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,               \
-                            &behavior_scaler_driver_api);
+                            &behavior_scaler_driver_api);                                   \
+    ZMK_INPUT_BEHAVIOR_FRAME_API_DT_INST_DEFINE(n, scaler_frame_process)                    \
+    ZMK_INPUT_BEHAVIOR_STATE_API_DT_INST_DEFINE(n, scaler_reset)
 
 DT_INST_FOREACH_STATUS_OKAY(IBSLR_INST)
 
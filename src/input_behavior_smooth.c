@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_input_behavior_smooth
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <drivers/behavior.h>
+#include <zephyr/input/input.h>
+#include <zephyr/sys/math_extras.h>
+#include <zephyr/dt-bindings/input/input-event-codes.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/keymap.h>
+#include <zmk/behavior.h>
+#include <zmk/input_behavior.h>
+
+#if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+#define SMOOTH_CODES (INPUT_REL_MISC + 1)
+// A gap longer than this ends the stroke, the next one starts from its first delta.
+#define SMOOTH_IDLE_MS ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS
+// 1 / (2 * pi) in the mHz * ms of fc * dt, that is 10^6 / (2 * pi)
+#define SMOOTH_INV_TWO_PI 159155
+
+struct behavior_smooth_config {
+    uint32_t min_cutoff_mhz;
+    uint32_t beta;
+};
+
+// Per axis, deltas in Q8.
+struct smooth_axis {
+    int32_t est;
+    int32_t rem;
+    // input not reported yet, flushed when the stroke ends
+    int32_t held;
+    uint32_t speed;
+    uint32_t last_ms;
+    uint16_t dt_ms;
+};
+
+struct behavior_smooth_data {
+    struct smooth_axis axes[SMOOTH_CODES];
+};
+
+/*
+ * One euro filter on the delta stream: a first order low-pass whose cutoff rises with speed,
+ * fc = min-cutoff + beta * speed. Slow, precise motion is smoothed hard, fast motion gets a
+ * cutoff well above the report rate and passes with next to no lag. The smoothing factor
+ * alpha = r / (1 + r) with r = 2 * pi * fc * dt is evaluated in Q16, fractions of the output
+ * are carried so the filter itself never rounds motion away, and whatever the lag still holds
+ * when the stroke ends is flushed by the listener.
+ */
+static uint32_t smooth_sat_add(uint32_t a, uint32_t b) {
+    uint32_t r;
+    return u32_add_overflow(a, b, &r) ? UINT32_MAX : r;
+}
+
+static uint32_t smooth_sat_mul(uint32_t a, uint32_t b) {
+    uint32_t r;
+    return u32_mul_overflow(a, b, &r) ? UINT32_MAX : r;
+}
+
+/*
+ * alpha = r / (1 + r) = c / (1 / (2 * pi) + c) with c = fc * dt, in Q16. Both terms are shifted
+ * down to 16 bits first so the one divide stays 32 bit, which costs a few LSB of an alpha that
+ * only weighs the next estimate.
+ */
+static uint32_t smooth_alpha_q16(uint32_t fc_mhz, uint32_t dt) {
+    uint32_t c = smooth_sat_mul(fc_mhz, dt);
+    uint32_t d = smooth_sat_add(SMOOTH_INV_TWO_PI, c);
+    uint32_t shift = 16 - u32_count_leading_zeros(d);
+    return ((c >> shift) << 16) / (d >> shift);
+}
+
+static int32_t smooth_take(struct smooth_axis *axis, int32_t out) {
+    axis->held -= out * (1 << 8);
+    return out;
+}
+
+static int32_t smooth_value(const struct behavior_smooth_config *config,
+                            struct smooth_axis *axis, int32_t value, uint32_t now) {
+    uint32_t dt = now - axis->last_ms;
+    axis->last_ms = now;
+    axis->held += value * (1 << 8);
+
+    if (dt > SMOOTH_IDLE_MS) {
+        axis->est = value * (1 << 8);
+        axis->rem = 0;
+        axis->speed = 0;
+        axis->dt_ms = 0;
+        // a stroke the flush did not get to ends with this delta instead of being dropped
+        return smooth_take(axis, axis->held / (1 << 8));
+    }
+    if (dt) {
+        axis->dt_ms = dt;
+    } else {
+        // x and y of one report share a timestamp, assume the report interval held
+        dt = MAX(axis->dt_ms, 1);
+    }
+
+    // speed includes this delta, so the cutoff opens on the first fast report already
+    uint32_t inst = (uint32_t)abs(value) * 1000 / dt;
+    axis->speed = (uint32_t)((int32_t)axis->speed + (((int32_t)inst - (int32_t)axis->speed) >> 1));
+
+    uint32_t fc_mhz =
+        smooth_sat_add(config->min_cutoff_mhz, smooth_sat_mul(config->beta, axis->speed));
+    int32_t alpha = (int32_t)smooth_alpha_q16(fc_mhz, dt);
+
+    axis->est += (int32_t)(((int64_t)(value * (1 << 8)) - axis->est) * alpha >> 16);
+
+    int32_t acc = axis->est + axis->rem;
+    int32_t out = acc / (1 << 8);
+    axis->rem = acc - out * (1 << 8);
+    return smooth_take(axis, out);
+}
+
+static int smooth_keymap_binding_pressed(struct zmk_behavior_binding *binding,
+                                         struct zmk_behavior_binding_event event) {
+    const struct device *dev = zmk_input_behavior_binding_dev(binding);
+    struct behavior_smooth_data *data = dev->data;
+    const struct behavior_smooth_config *config = dev->config;
+
+    struct input_event *evt = (struct input_event *)(uintptr_t)event.position;
+    if (evt->type != INPUT_EV_REL || evt->code >= SMOOTH_CODES || !evt->value) {
+        return ZMK_BEHAVIOR_TRANSPARENT;
+    }
+
+    evt->value =
+        smooth_value(config, &data->axes[evt->code], evt->value, (uint32_t)event.timestamp);
+    // a held back sync still has to close the frame, with nothing left to report in it
+    return (evt->value || evt->sync) ? ZMK_BEHAVIOR_TRANSPARENT : ZMK_BEHAVIOR_OPAQUE;
+}
+
+static const uint16_t smooth_frame_codes[] = {INPUT_REL_X, INPUT_REL_Y, INPUT_REL_WHEEL,
+                                              INPUT_REL_HWHEEL};
+
+static int smooth_frame_process(const struct device *dev, struct zmk_behavior_binding *binding,
+                                struct zmk_input_behavior_frame *frame) {
+    struct behavior_smooth_data *data = dev->data;
+    const struct behavior_smooth_config *config = dev->config;
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(smooth_frame_codes); i++) {
+        uint16_t code = smooth_frame_codes[i];
+        int32_t *value = zmk_input_behavior_frame_field(frame, code);
+        if (*value) {
+            *value = smooth_value(config, &data->axes[code], *value, (uint32_t)frame->timestamp);
+        }
+    }
+    return ZMK_BEHAVIOR_TRANSPARENT;
+}
+
+// The stroke is over, hands out what the lag still holds and starts the next one fresh.
+static void smooth_flush(const struct device *dev, struct zmk_behavior_binding *binding,
+                         struct zmk_input_behavior_frame *frame) {
+    struct behavior_smooth_data *data = dev->data;
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(smooth_frame_codes); i++) {
+        uint16_t code = smooth_frame_codes[i];
+        struct smooth_axis *axis = &data->axes[code];
+        *zmk_input_behavior_frame_field(frame, code) += smooth_take(axis, axis->held / (1 << 8));
+        axis->est = axis->rem = 0;
+        axis->speed = 0;
+        axis->dt_ms = 0;
+    }
+}
+
+static void smooth_reset(const struct device *dev) {
+    memset(dev->data, 0, sizeof(struct behavior_smooth_data));
+}
+
+static const struct behavior_driver_api behavior_smooth_driver_api = {
+    .binding_pressed = smooth_keymap_binding_pressed,
+};
+
+#define SMOOTH_INST(n)                                                                             \
+    static struct behavior_smooth_data behavior_smooth_data_##n = {};                              \
+    static const struct behavior_smooth_config behavior_smooth_config_##n = {                      \
+        .min_cutoff_mhz = DT_INST_PROP(n, min_cutoff_mhz),                                         \
+        .beta = DT_INST_PROP(n, beta),                                                             \
+    };                                                                                             \
+    BEHAVIOR_DT_INST_DEFINE(n, NULL, NULL, &behavior_smooth_data_##n, &behavior_smooth_config_##n, \
+                            POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,                      \
+                            &behavior_smooth_driver_api);                                          \
+    ZMK_INPUT_BEHAVIOR_FRAME_API_DT_INST_DEFINE(n, smooth_frame_process)                           \
+    ZMK_INPUT_BEHAVIOR_FLUSH_API_DT_INST_DEFINE(n, smooth_flush)                                   \
+    ZMK_INPUT_BEHAVIOR_STATE_API_DT_INST_DEFINE(n, smooth_reset)
+
+DT_INST_FOREACH_STATUS_OKAY(SMOOTH_INST)
+
+#endif /* DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT) */
@@ -6,20 +6,27 @@
 
 #define DT_DRV_COMPAT zmk_input_behavior_tog_layer
 
+#include <stdlib.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <drivers/behavior.h>
+#include <zephyr/input/input.h>
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #include <zmk/keymap.h>
 #include <zmk/behavior.h>
+#include <zmk/input_behavior.h>
 
 // #if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
 
 struct behavior_tog_layer_config {
     uint32_t time_to_live_ms;
+    bool sync_activation;
+    uint32_t activation_distance;
+    uint32_t activation_events;
+    uint32_t activation_window_ms;
 };
 
 struct behavior_tog_layer_data {
@@ -27,13 +34,42 @@ struct behavior_tog_layer_data {
     struct k_work_delayable toggle_layer_activate_work;
     struct k_work_delayable toggle_layer_deactivate_work;
     const struct device *dev;
+    // uptime of the latest input, the deactivate work checks it when its deadline comes up
+    atomic_t last_activity;
+    atomic_t deadline_armed;
+    // motion seen in the current activation window while the layer is off
+    uint32_t window_start;
+    uint32_t window_distance;
+    uint32_t window_events;
 };
 
+static inline uint32_t idle_ms(struct behavior_tog_layer_data *data) {
+    return k_uptime_get_32() - (uint32_t)atomic_get(&data->last_activity);
+}
+
 static void toggle_layer_deactivate_cb(struct k_work *work) {
     struct k_work_delayable *work_delayable = (struct k_work_delayable *)work;
     struct behavior_tog_layer_data *data = CONTAINER_OF(work_delayable, 
                                                         struct behavior_tog_layer_data,
                                                         toggle_layer_deactivate_work);
+    const struct behavior_tog_layer_config *cfg = data->dev->config;
+
+    // Input arrived since this deadline was set, sleep until the one it implies.
+    uint32_t idle = idle_ms(data);
+    if (idle < cfg->time_to_live_ms) {
+        k_work_schedule(work_delayable, K_MSEC(cfg->time_to_live_ms - idle));
+        return;
+    }
+
+    // Disarm before the last look at the timestamp, input stored after that look finds the
+    // deadline disarmed and arms a new one itself.
+    atomic_clear(&data->deadline_armed);
+    idle = idle_ms(data);
+    if (idle < cfg->time_to_live_ms && atomic_cas(&data->deadline_armed, 0, 1)) {
+        k_work_schedule(work_delayable, K_MSEC(cfg->time_to_live_ms - idle));
+        return;
+    }
+
     if (!zmk_keymap_layer_active(data->toggle_layer)) {
       return;
     }
@@ -50,20 +86,111 @@ static void toggle_layer_activate_cb(struct k_work *work) {
     zmk_keymap_layer_activate(data->toggle_layer);
 }
 
-static int to_keymap_binding_pressed(struct zmk_behavior_binding *binding,
-                                     struct zmk_behavior_binding_event event) {
-    const struct device *dev = zmk_behavior_get_binding(binding->behavior_dev);
-    struct behavior_tog_layer_data *data = (struct behavior_tog_layer_data *)dev->data;
+/*
+ * Waking the layer takes activation-distance of relative motion or activation-events events
+ * within activation-window-ms, whichever comes first, so a stray bump does not broadcast two
+ * layer changes. A criterion left at 0 is not configured, with neither any input wakes the
+ * layer. Once the layer is up any input keeps it alive, the hysteresis between the two keeps it
+ * from flapping.
+ */
+static bool activation_reached(const struct behavior_tog_layer_config *cfg,
+                               struct behavior_tog_layer_data *data, uint32_t distance,
+                               uint32_t now) {
+    if (!cfg->activation_distance && !cfg->activation_events) {
+        return true;
+    }
+
+    if (now - data->window_start > cfg->activation_window_ms) {
+        data->window_start = now;
+        data->window_distance = data->window_events = 0;
+    }
+    data->window_distance += distance;
+    data->window_events++;
+
+    if ((!cfg->activation_distance || data->window_distance < cfg->activation_distance) &&
+        (!cfg->activation_events || data->window_events < cfg->activation_events)) {
+        return false;
+    }
+    data->window_distance = data->window_events = 0;
+    return true;
+}
+
+/*
+ * One input for the layer: an event, or a whole frame from a frame mode listener. Buttons are
+ * always deliberate and skip the activation criteria.
+ */
+static int tog_layer_input(const struct device *dev, uint8_t layer, uint32_t distance,
+                           bool button, uint32_t now) {
+    struct behavior_tog_layer_data *data = dev->data;
     const struct behavior_tog_layer_config *cfg = dev->config;
-    data->toggle_layer = binding->param1;
+    data->toggle_layer = layer;
+
+    bool engaged = atomic_get(&data->deadline_armed) || zmk_keymap_layer_active(data->toggle_layer);
+    if (!engaged && !button && !activation_reached(cfg, data, distance, now)) {
+        return ZMK_BEHAVIOR_TRANSPARENT;
+    }
+
+    bool activated = false;
     if (!zmk_keymap_layer_active(data->toggle_layer)) {
-        // LOG_DBG("schedule activate layer %d", data->toggle_layer);
-        k_work_schedule(&data->toggle_layer_activate_work, K_MSEC(0));
+        if (cfg->sync_activation) {
+            LOG_DBG("activate layer %d", data->toggle_layer);
+            zmk_keymap_layer_activate(data->toggle_layer);
+            activated = true;
+        } else {
+            // LOG_DBG("schedule activate layer %d", data->toggle_layer);
+            k_work_schedule(&data->toggle_layer_activate_work, K_MSEC(0));
+        }
+    }
+
+    // Only the first input after an idle period touches the kernel timeout, later ones just
+    // move the lazy deadline forward.
+    atomic_set(&data->last_activity, (atomic_val_t)now);
+    if (atomic_cas(&data->deadline_armed, 0, 1)) {
+        k_work_schedule(&data->toggle_layer_deactivate_work, K_MSEC(cfg->time_to_live_ms));
+    }
+
+    // Once the toggle layer is on top the listener dispatcher replays this event to its
+    // listeners, so the current listener must not report it under the old layer as well.
+    if (activated && zmk_keymap_highest_layer_active() == data->toggle_layer) {
+        return ZMK_BEHAVIOR_OPAQUE;
     }
-    k_work_schedule(&data->toggle_layer_deactivate_work, K_MSEC(cfg->time_to_live_ms));
     return ZMK_BEHAVIOR_TRANSPARENT;
 }
 
+static int to_keymap_binding_pressed(struct zmk_behavior_binding *binding,
+                                     struct zmk_behavior_binding_event event) {
+    const struct device *dev = zmk_input_behavior_binding_dev(binding);
+    const struct input_event *evt = (const struct input_event *)(uintptr_t)event.position;
+    uint32_t distance = (evt && evt->type == INPUT_EV_REL) ? (uint32_t)abs(evt->value) : 0;
+    bool button = evt && evt->type == INPUT_EV_KEY;
+
+    return tog_layer_input(dev, binding->param1, distance, button, (uint32_t)event.timestamp);
+}
+
+// A frame counts as one event, with the motion of all its axes.
+static int tog_layer_frame_process(const struct device *dev, struct zmk_behavior_binding *binding,
+                                   struct zmk_input_behavior_frame *frame) {
+    uint32_t distance = (uint32_t)abs(frame->x) + (uint32_t)abs(frame->y) +
+                        (uint32_t)abs(frame->wheel) + (uint32_t)abs(frame->hwheel);
+    bool button = frame->button_set || frame->button_clear;
+
+    return tog_layer_input(dev, binding->param1, distance, button, (uint32_t)frame->timestamp);
+}
+
+static void tog_layer_reset(const struct device *dev) {
+    struct behavior_tog_layer_data *data = dev->data;
+    struct k_work_sync sync;
+
+    k_work_cancel_delayable_sync(&data->toggle_layer_activate_work, &sync);
+    k_work_cancel_delayable_sync(&data->toggle_layer_deactivate_work, &sync);
+    // an armed deadline means the layer is ours, drop it as the deadline would have
+    if (atomic_clear(&data->deadline_armed) && zmk_keymap_layer_active(data->toggle_layer)) {
+        zmk_keymap_layer_deactivate(data->toggle_layer);
+    }
+    atomic_clear(&data->last_activity);
+    data->window_start = data->window_distance = data->window_events = 0;
+}
+
 static int input_behavior_to_init(const struct device *dev) {
     struct behavior_tog_layer_data *data = dev->data;
     data->dev = dev;
@@ -80,12 +207,18 @@ static const struct behavior_driver_api behavior_tog_layer_driver_api = {
     static struct behavior_tog_layer_data behavior_tog_layer_data_##n = {};             \
     static struct behavior_tog_layer_config behavior_tog_layer_config_##n = {           \
         .time_to_live_ms = DT_INST_PROP(n, time_to_live_ms),                            \
+        .sync_activation = DT_INST_PROP(n, sync_activation),                            \
+        .activation_distance = DT_INST_PROP(n, activation_distance),                    \
+        .activation_events = DT_INST_PROP(n, activation_events),                        \
+        .activation_window_ms = DT_INST_PROP(n, activation_window_ms),                  \
     };                                                                                  \
     BEHAVIOR_DT_INST_DEFINE(n, input_behavior_to_init, NULL,                            \
                             &behavior_tog_layer_data_##n,                               \
                             &behavior_tog_layer_config_##n,                             \
                             POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,           \
-                            &behavior_tog_layer_driver_api);
+                            &behavior_tog_layer_driver_api);                            \
+    ZMK_INPUT_BEHAVIOR_FRAME_API_DT_INST_DEFINE(n, tog_layer_frame_process)             \
+    ZMK_INPUT_BEHAVIOR_STATE_API_DT_INST_DEFINE(n, tog_layer_reset)
 
 DT_INST_FOREACH_STATUS_OKAY(KP_INST)
 
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+// Test double of ZMK's <drivers/behavior.h>: behaviors are plain devices looked up by name.
+
+#include <errno.h>
+#include <stddef.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zmk/behavior.h>
+
+struct zmk_sensor_config {
+    uint16_t triggers_per_rotation;
+};
+
+struct zmk_sensor_channel_data {
+    enum sensor_channel channel;
+    struct sensor_value value;
+};
+
+enum behavior_sensor_binding_process_mode {
+    BEHAVIOR_SENSOR_BINDING_PROCESS_MODE_TRIGGER,
+    BEHAVIOR_SENSOR_BINDING_PROCESS_MODE_DISCARD,
+};
+
+typedef int (*behavior_keymap_binding_callback_t)(struct zmk_behavior_binding *binding,
+                                                  struct zmk_behavior_binding_event event);
+typedef int (*behavior_sensor_keymap_binding_process_callback_t)(
+    struct zmk_behavior_binding *binding, struct zmk_behavior_binding_event event,
+    enum behavior_sensor_binding_process_mode mode);
+typedef int (*behavior_sensor_keymap_binding_accept_data_callback_t)(
+    struct zmk_behavior_binding *binding, struct zmk_behavior_binding_event event,
+    const struct zmk_sensor_config *sensor_config, size_t channel_data_size,
+    const struct zmk_sensor_channel_data *channel_data);
+
+struct behavior_driver_api {
+    behavior_keymap_binding_callback_t binding_pressed;
+    behavior_keymap_binding_callback_t binding_released;
+    behavior_sensor_keymap_binding_accept_data_callback_t sensor_binding_accept_data;
+    behavior_sensor_keymap_binding_process_callback_t sensor_binding_process;
+};
+
+#define BEHAVIOR_DT_INST_DEFINE(inst, ...) DEVICE_DT_INST_DEFINE(inst, __VA_ARGS__)
+
+static inline int
+behavior_sensor_keymap_binding_accept_data(struct zmk_behavior_binding *binding,
+                                           struct zmk_behavior_binding_event event,
+                                           const struct zmk_sensor_config *sensor_config,
+                                           size_t channel_data_size,
+                                           const struct zmk_sensor_channel_data *channel_data) {
+    const struct device *dev = zmk_behavior_get_binding(binding->behavior_dev);
+    const struct behavior_driver_api *api = dev ? dev->api : NULL;
+    if (!api || !api->sensor_binding_accept_data) {
+        return -ENOTSUP;
+    }
+    return api->sensor_binding_accept_data(binding, event, sensor_config, channel_data_size,
+                                           channel_data);
+}
+
+static inline int
+behavior_sensor_keymap_binding_process(struct zmk_behavior_binding *binding,
+                                       struct zmk_behavior_binding_event event,
+                                       enum behavior_sensor_binding_process_mode mode) {
+    const struct device *dev = zmk_behavior_get_binding(binding->behavior_dev);
+    const struct behavior_driver_api *api = dev ? dev->api : NULL;
+    if (!api || !api->sensor_binding_process) {
+        return -ENOTSUP;
+    }
+    return api->sensor_binding_process(binding, event, mode);
+}
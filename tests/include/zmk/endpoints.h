@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+enum zmk_transport {
+    ZMK_TRANSPORT_USB,
+    ZMK_TRANSPORT_BLE,
+};
+
+struct zmk_endpoint_instance {
+    enum zmk_transport transport;
+};
+
+struct zmk_endpoint_instance zmk_endpoints_selected(void);
+int zmk_endpoints_send_mouse_report(void);
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+// Test double of ZMK's event manager: synchronous delivery to subscriptions in link order.
+
+#include <stdint.h>
+#include <zephyr/sys/iterable_sections.h>
+
+struct zmk_event_type {
+    const char *name;
+};
+
+typedef struct {
+    const struct zmk_event_type *event;
+} zmk_event_t;
+
+#define ZMK_EV_EVENT_BUBBLE 0
+#define ZMK_EV_EVENT_HANDLED 1
+#define ZMK_EV_EVENT_CAPTURED 2
+
+struct zmk_listener {
+    int (*callback)(const zmk_event_t *eh);
+};
+
+struct zmk_event_subscription {
+    const struct zmk_event_type *event_type;
+    const struct zmk_listener *listener;
+};
+
+#define ZMK_LISTENER(mod, cb) const struct zmk_listener zmk_listener_##mod = {.callback = cb};
+
+#define ZMK_SUBSCRIPTION(mod, ev_type)                                                             \
+    const STRUCT_SECTION_ITERABLE(zmk_event_subscription, zmk_event_sub_##mod##_##ev_type) = {     \
+        .event_type = &zmk_event_##ev_type,                                                        \
+        .listener = &zmk_listener_##mod,                                                           \
+    };
+
+#define ZMK_EVENT_DECLARE(event_type)                                                              \
+    struct event_type##_event {                                                                    \
+        zmk_event_t header;                                                                        \
+        struct event_type data;                                                                    \
+    };                                                                                             \
+    extern const struct zmk_event_type zmk_event_##event_type;                                     \
+    static inline struct event_type *as_##event_type(const zmk_event_t *eh) {                      \
+        return (eh->event == &zmk_event_##event_type) ? &((struct event_type##_event *)eh)->data   \
+                                                      : NULL;                                      \
+    }                                                                                              \
+    int raise_##event_type(struct event_type data);
+
+#define ZMK_EVENT_IMPL(event_type)                                                                 \
+    const struct zmk_event_type zmk_event_##event_type = {.name = #event_type};                    \
+    int raise_##event_type(struct event_type data) {                                               \
+        struct event_type##_event ev = {.header = {.event = &zmk_event_##event_type},              \
+                                        .data = data};                                             \
+        return zmk_event_manager_raise(&ev.header);                                                \
+    }
+
+int zmk_event_manager_raise(zmk_event_t *event);
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+// Test double of ZMK's mouse HID report, see test_stubs.h for what the tests read back.
+
+#include <stdint.h>
+
+#define ZMK_MOUSE_HID_NUM_BUTTONS 0x05
+
+void zmk_hid_mouse_movement_set(int16_t x, int16_t y);
+void zmk_hid_mouse_scroll_set(int8_t x, int8_t y);
+int zmk_hid_mouse_button_press(uint8_t button);
+int zmk_hid_mouse_button_release(uint8_t button);
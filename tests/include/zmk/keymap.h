@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+// Test double of ZMK's keymap: a layer bitmask, changes are raised as layer_state_changed.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ZMK_KEYMAP_LAYERS_LEN 21
+
+typedef uint32_t zmk_keymap_layers_state_t;
+
+zmk_keymap_layers_state_t zmk_keymap_layer_state(void);
+bool zmk_keymap_layer_active(uint8_t layer);
+uint8_t zmk_keymap_highest_layer_active(void);
+int zmk_keymap_layer_activate(uint8_t layer);
+int zmk_keymap_layer_deactivate(uint8_t layer);
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Microbenchmarks of the listener stages and the bindings of listener_bench, one table row per
+ * stage, shape and rate. Times come from the host clock, so rows compare across commits on the
+ * same machine. Allocations and timeout operations are counted through linker wraps, see
+ * CMakeLists.txt, with what the state reset around every run costs taken off. The wraps only
+ * rename references between objects, so a call the kernel makes within its own source, such as
+ * k_work_schedule() into k_work_schedule_for_queue(), is counted once, at the outer call.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/ztest.h>
+
+#include <zmk/input_behavior.h>
+
+#include "test_stubs.h"
+
+#define BENCH_LISTENER "listener_bench"
+#define BENCH_FRAMES 1000
+
+// in the native simulator runner, host/bench_clock.c
+extern uint64_t bench_host_ns(void);
+
+static atomic_t allocs;
+static atomic_t timeout_ops;
+
+void *__real_k_heap_alloc(struct k_heap *h, size_t bytes, k_timeout_t timeout);
+void *__real_k_heap_aligned_alloc(struct k_heap *h, size_t align, size_t bytes,
+                                  k_timeout_t timeout);
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_k_work_schedule(struct k_work_delayable *dwork, k_timeout_t delay);
+int __real_k_work_schedule_for_queue(struct k_work_q *queue, struct k_work_delayable *dwork,
+                                     k_timeout_t delay);
+int __real_k_work_reschedule(struct k_work_delayable *dwork, k_timeout_t delay);
+int __real_k_work_reschedule_for_queue(struct k_work_q *queue, struct k_work_delayable *dwork,
+                                       k_timeout_t delay);
+int __real_k_work_cancel_delayable(struct k_work_delayable *dwork);
+bool __real_k_work_cancel_delayable_sync(struct k_work_delayable *dwork,
+                                         struct k_work_sync *sync);
+
+void *__wrap_k_heap_alloc(struct k_heap *h, size_t bytes, k_timeout_t timeout) {
+    atomic_inc(&allocs);
+    return __real_k_heap_alloc(h, bytes, timeout);
+}
+
+void *__wrap_k_heap_aligned_alloc(struct k_heap *h, size_t align, size_t bytes,
+                                  k_timeout_t timeout) {
+    atomic_inc(&allocs);
+    return __real_k_heap_aligned_alloc(h, align, bytes, timeout);
+}
+
+void *__wrap_malloc(size_t size) {
+    atomic_inc(&allocs);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    atomic_inc(&allocs);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    atomic_inc(&allocs);
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_k_work_schedule(struct k_work_delayable *dwork, k_timeout_t delay) {
+    atomic_inc(&timeout_ops);
+    return __real_k_work_schedule(dwork, delay);
+}
+
+int __wrap_k_work_schedule_for_queue(struct k_work_q *queue, struct k_work_delayable *dwork,
+                                     k_timeout_t delay) {
+    atomic_inc(&timeout_ops);
+    return __real_k_work_schedule_for_queue(queue, dwork, delay);
+}
+
+int __wrap_k_work_reschedule(struct k_work_delayable *dwork, k_timeout_t delay) {
+    atomic_inc(&timeout_ops);
+    return __real_k_work_reschedule(dwork, delay);
+}
+
+int __wrap_k_work_reschedule_for_queue(struct k_work_q *queue, struct k_work_delayable *dwork,
+                                       k_timeout_t delay) {
+    atomic_inc(&timeout_ops);
+    return __real_k_work_reschedule_for_queue(queue, dwork, delay);
+}
+
+int __wrap_k_work_cancel_delayable(struct k_work_delayable *dwork) {
+    atomic_inc(&timeout_ops);
+    return __real_k_work_cancel_delayable(dwork);
+}
+
+bool __wrap_k_work_cancel_delayable_sync(struct k_work_delayable *dwork,
+                                         struct k_work_sync *sync) {
+    atomic_inc(&timeout_ops);
+    return __real_k_work_cancel_delayable_sync(dwork, sync);
+}
+
+static const char *const bench_stage_names[] = {
+    [ZMK_INPUT_BEHAVIOR_BENCH_TRANSFORM] = "transform",
+    [ZMK_INPUT_BEHAVIOR_BENCH_BINDING] = "binding",
+    [ZMK_INPUT_BEHAVIOR_BENCH_SYNC] = "sync",
+};
+
+static const char *const bench_shapes[] = {"circle", "flick", "jitter", "scroll"};
+static const uint32_t bench_rates_hz[] = {125, 1000, 8000};
+
+struct bench_counts {
+    atomic_val_t allocs;
+    atomic_val_t timeout_ops;
+};
+
+static int bench_counted(struct zmk_input_behavior_bench_run *run,
+                         struct zmk_input_behavior_bench_result *res, struct bench_counts *counts) {
+    atomic_val_t allocs_start = atomic_get(&allocs);
+    atomic_val_t timeout_ops_start = atomic_get(&timeout_ops);
+
+    int ret = zmk_input_behavior_bench(run, res);
+    counts->allocs = atomic_get(&allocs) - allocs_start;
+    counts->timeout_ops = atomic_get(&timeout_ops) - timeout_ops_start;
+    return ret;
+}
+
+/*
+ * tog-layer pushes its deactivation deadline on any input and move-to-keypress schedules its
+ * taps on motion, so a row without timeout operations means the wraps missed them.
+ */
+static bool bench_expects_timeouts(const char *binding, const char *shape) {
+    return !strcmp(binding, "ib_tog") || (!strcmp(binding, "ib_m2k") && strcmp(shape, "scroll"));
+}
+
+// Returns -ENOENT once run->binding is past the last binding.
+static int bench_row(struct zmk_input_behavior_bench_run *run) {
+    struct zmk_input_behavior_bench_result res;
+    struct bench_counts base;
+    struct bench_counts counts;
+    uint32_t frames = run->frames;
+
+    // an empty trace only costs the reset before and after, which is not the stage's
+    run->frames = 0;
+    int ret = bench_counted(run, &res, &base);
+    run->frames = frames;
+    if (ret) {
+        return ret;
+    }
+    zassert_ok(bench_counted(run, &res, &counts));
+
+    uint64_t ns = res.events ? res.total_ns / res.events : 0;
+    TC_PRINT("%s %s %s %s %u %u %llu %llu %ld %ld\n", bench_stage_names[run->stage],
+             run->listener, res.binding ? res.binding : "-", run->shape, run->hz, res.events,
+             (unsigned long long)ns, (unsigned long long)res.max_ns,
+             (long)(counts.allocs - base.allocs),
+             (long)(counts.timeout_ops - base.timeout_ops));
+
+    zassert_true(res.events > 0);
+    zassert_equal(counts.allocs, base.allocs, "%s allocates on the input path",
+                  res.binding ? res.binding : bench_stage_names[run->stage]);
+    if (res.binding && bench_expects_timeouts(res.binding, run->shape)) {
+        zassert_true(counts.timeout_ops > base.timeout_ops, "no timeout operations counted for %s",
+                     res.binding);
+    }
+    return 0;
+}
+
+static void before(void *fixture) {
+    ARG_UNUSED(fixture);
+    test_stubs_reset();
+}
+
+ZTEST_SUITE(bench, NULL, NULL, before, NULL, NULL);
+
+ZTEST(bench, test_stages) {
+    TC_PRINT("# input_behavior bench v2 stage listener binding shape hz events ns/event max_ns "
+             "allocs timeout_ops\n");
+
+    for (uint8_t s = 0; s < ARRAY_SIZE(bench_shapes); s++) {
+        for (uint8_t r = 0; r < ARRAY_SIZE(bench_rates_hz); r++) {
+            struct zmk_input_behavior_bench_run run = {
+                .listener = BENCH_LISTENER,
+                .shape = bench_shapes[s],
+                .hz = bench_rates_hz[r],
+                .frames = BENCH_FRAMES,
+                .clock = bench_host_ns,
+            };
+
+            run.stage = ZMK_INPUT_BEHAVIOR_BENCH_TRANSFORM;
+            zassert_ok(bench_row(&run));
+
+            run.stage = ZMK_INPUT_BEHAVIOR_BENCH_BINDING;
+            for (run.binding = 0; bench_row(&run) != -ENOENT; run.binding++) {
+            }
+            zassert_equal(run.binding, 3, "listener_bench has 3 bindings");
+
+            run.stage = ZMK_INPUT_BEHAVIOR_BENCH_SYNC;
+            zassert_ok(bench_row(&run));
+        }
+    }
+}
+
+/*
+ * tog-layer's lazy deadline: continuous motion arms it once, then the deadline re-arms itself
+ * for what is left of time-to-live-ms after the latest input, at least ttl minus one frame
+ * period later. Scheduling on every event would cost one operation per event.
+ */
+ZTEST(bench, test_tog_layer_timeout_ops) {
+    const uint32_t ttl_ms = DT_PROP(DT_NODELABEL(ib_tog), time_to_live_ms);
+
+    for (uint8_t r = 0; r < ARRAY_SIZE(bench_rates_hz); r++) {
+        struct zmk_input_behavior_bench_run run = {
+            .listener = BENCH_LISTENER,
+            .stage = ZMK_INPUT_BEHAVIOR_BENCH_BINDING,
+            // ib_tog
+            .binding = 1,
+            .shape = "circle",
+            .hz = bench_rates_hz[r],
+            .frames = 0,
+            .clock = bench_host_ns,
+        };
+        struct zmk_input_behavior_bench_result res;
+        struct bench_counts base;
+        struct bench_counts counts;
+
+        zassert_ok(bench_counted(&run, &res, &base));
+        run.frames = BENCH_FRAMES;
+        zassert_ok(bench_counted(&run, &res, &counts));
+        zassert_ok(strcmp(res.binding, "ib_tog"));
+
+        uint32_t trace_ms = BENCH_FRAMES * 1000 / run.hz;
+        uint32_t rearm_ms = ttl_ms - DIV_ROUND_UP(1000, run.hz);
+        long ops = counts.timeout_ops - base.timeout_ops;
+        TC_PRINT("tog-layer timeout ops: %u events over %u ms at %u Hz, %ld ops\n", res.events,
+                 trace_ms, run.hz, ops);
+        zassert_true(ops > 0 && ops <= 2 + DIV_ROUND_UP(trace_ms, rearm_ms), "%ld ops", ops);
+    }
+}
+
+ZTEST(bench, test_rejects_bad_runs) {
+    struct zmk_input_behavior_bench_result res;
+    struct zmk_input_behavior_bench_run run = {
+        .listener = BENCH_LISTENER,
+        .stage = ZMK_INPUT_BEHAVIOR_BENCH_TRANSFORM,
+        .shape = "circle",
+        .hz = 1000,
+        .frames = 1,
+        .clock = bench_host_ns,
+    };
+
+    run.shape = "square";
+    zassert_equal(zmk_input_behavior_bench(&run, &res), -EINVAL);
+    run.shape = "circle";
+    run.listener = "listener_missing";
+    zassert_equal(zmk_input_behavior_bench(&run, &res), -EINVAL);
+    run.listener = BENCH_LISTENER;
+    run.stage = ZMK_INPUT_BEHAVIOR_BENCH_BINDING;
+    run.binding = 3;
+    zassert_equal(zmk_input_behavior_bench(&run, &res), -ENOENT);
+}
@@ -0,0 +1,780 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/input/input.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/shell/shell_dummy.h>
+#include <zephyr/ztest.h>
+
+#include <zmk/input_behavior.h>
+#include <zmk/keymap.h>
+
+#include "test_stubs.h"
+
+#define LAYER_BASE 0
+#define LAYER_SCALE 1
+#define LAYER_M2K 2
+#define LAYER_SCALE_UP 3
+#define LAYER_MULTIPLIER 4
+#define LAYER_SMOOTH 5
+#define LAYER_SCALE_NONE 8
+#define LAYER_TOG_SYNC 9
+#define LAYER_TOG_SYNC_FRAME 10
+#define LAYER_TOG_TARGET 11
+#define LAYER_ROTATE 12
+#define LAYER_DEADZONE 13
+#define LAYER_ACCEL 14
+#define LAYER_TOG_DIST 15
+#define LAYER_TOG_DIST_TARGET 16
+#define LAYER_FRAME 17
+#define LAYER_TOG_EVENTS 18
+#define LAYER_TOG_EVENTS_TARGET 19
+#define LAYER_ACCEL_WIDE 20
+// woken by ib_tog from listener_frame, nothing listens on it
+#define LAYER_TOG_BENCH 6
+
+// long enough for the deferred thread and a few move-to-keypress taps
+#define SETTLE_MS 200
+
+static void settle(void) { k_msleep(SETTLE_MS); }
+
+static void before(void *fixture) {
+    ARG_UNUSED(fixture);
+    settle();
+    test_stubs_reset();
+}
+
+ZTEST_SUITE(listener, NULL, NULL, before, NULL, NULL);
+
+ZTEST(listener, test_passthrough) {
+    input_report_rel(test_trackball, INPUT_REL_X, 5, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_Y, -3, true, K_FOREVER);
+    settle();
+
+    zassert_equal(test_reports_len, 1);
+    zassert_equal(test_reports[0].x, 5);
+    zassert_equal(test_reports[0].y, -3);
+}
+
+ZTEST(listener, test_empty_reports_suppressed) {
+    // a zero delta, a second press of a held button and motion the scaler keeps as a remainder
+    input_report_rel(test_trackball, INPUT_REL_X, 0, true, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 1, true, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 1, true, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 0, true, K_FOREVER);
+    settle();
+    zmk_keymap_layer_activate(LAYER_SCALE);
+    input_report_rel(test_trackball, INPUT_REL_X, 7, true, K_FOREVER);
+    settle();
+
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(test_reports[0].buttons, BIT(0));
+    zassert_equal(test_reports[1].buttons, 0);
+}
+
+ZTEST(listener, test_report_diffing) {
+    input_report_rel(test_trackball, INPUT_REL_X, 4, true, K_FOREVER);
+    // past the poll interval, so pacing does not fold the two together
+    k_msleep(2);
+    input_report_rel(test_trackball, INPUT_REL_WHEEL, 1, true, K_FOREVER);
+    settle();
+
+    // motion and scroll are deltas, the wheel report must not repeat the x before it
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(test_reports[0].x, 4);
+    zassert_equal(test_reports[0].scroll_y, 0);
+    zassert_equal(test_reports[1].x, 0);
+    zassert_equal(test_reports[1].scroll_y, 1);
+}
+
+ZTEST(listener, test_report_pacing) {
+    // ten frames in one go, far faster than the 1 ms USB poll interval
+    for (int i = 0; i < 10; i++) {
+        input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    }
+    settle();
+
+    int32_t x = 0;
+    for (uint32_t i = 0; i < test_reports_len; i++) {
+        x += test_reports[i].x;
+    }
+    zassert_equal(x, 10);
+#if IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_REPORT_PACING)
+    // one report as soon as the work queue gets to it, what came in meanwhile waits an interval
+    zassert_between_inclusive(test_reports_len, 1, 2);
+#elif !IS_ENABLED(CONFIG_ZMK_INPUT_BEHAVIOR_LISTENER_DEFERRED)
+    zassert_equal(test_reports_len, 10);
+#endif
+}
+
+ZTEST(listener, test_layer_gating) {
+    zmk_keymap_layer_activate(LAYER_SCALE);
+    // 8 counts are one after the 1/8 scaler, layer 0 would have sent all 8
+    input_report_rel(test_trackball, INPUT_REL_X, 8, true, K_FOREVER);
+    settle();
+
+    zassert_equal(test_reports_len, 1);
+    zassert_equal(test_reports[0].x, 1);
+}
+
+struct replay_result {
+    unsigned long events;
+    unsigned long reports;
+    long keypresses;
+    unsigned long crc;
+};
+
+static struct replay_result replay(const char *cmd) {
+    const struct shell *sh = shell_backend_dummy_get_ptr();
+    struct replay_result res = {0};
+    size_t size;
+
+    shell_backend_dummy_clear_output(sh);
+    int ret = shell_execute_cmd(sh, cmd);
+    const char *out = shell_backend_dummy_get_output(sh, &size);
+    zassert_ok(ret, "%s failed: %s", cmd, out);
+
+    const char *line = strstr(out, "events ");
+    zassert_not_null(line, "no summary in: %s", out);
+    zassert_equal(sscanf(line, "events %lu reports %lu keypresses %ld", &res.events,
+                         &res.reports, &res.keypresses),
+                  3);
+    line = strstr(out, "crc 0x");
+    zassert_not_null(line, "no crc in: %s", out);
+    res.crc = strtoul(line + strlen("crc 0x"), NULL, 16);
+    return res;
+}
+
+// A run in between must not leave remainders, queued taps or pressed keys behind.
+static void assert_replay_reproducible(const char *cmd) {
+    struct replay_result first = replay(cmd);
+    replay("ibl replay gen jitter 1000 77");
+    struct replay_result second = replay(cmd);
+
+    zassert_true(first.events > 0);
+    zassert_equal(first.events, second.events);
+    zassert_equal(first.reports, second.reports);
+    zassert_equal(first.keypresses, second.keypresses);
+    zassert_equal(first.crc, second.crc, "0x%08lx != 0x%08lx", first.crc, second.crc);
+}
+
+ZTEST(listener, test_replay_reproducible_scaled) {
+    zmk_keymap_layer_activate(LAYER_SCALE);
+    assert_replay_reproducible("ibl replay gen circle 1000 300");
+}
+
+ZTEST(listener, test_replay_reproducible_m2k) {
+    zmk_keymap_layer_activate(LAYER_M2K);
+    assert_replay_reproducible("ibl replay gen flick 1000 300");
+    zassert_true(test_keys_len > 0);
+}
+
+ZTEST(listener, test_replay_releases_keys) {
+    zmk_keymap_layer_activate(LAYER_M2K);
+    replay("ibl replay gen flick 1000 300");
+    settle();
+
+    int32_t pressed = 0;
+    for (uint32_t i = 0; i < test_keys_len; i++) {
+        pressed += test_keys[i].pressed ? 1 : -1;
+    }
+    zassert_equal(pressed, 0, "%d keys left pressed", pressed);
+}
+
+ZTEST(listener, test_replay_sends_nothing) {
+    zmk_keymap_layer_activate(LAYER_SCALE);
+    struct replay_result res = replay("ibl replay gen circle 1000 100");
+
+    zassert_true(res.reports > 0);
+    zassert_equal(test_reports_len, 0);
+}
+
+/*
+ * Golden output of the generated traces. The crc covers reports and the key events bindings
+ * raised, and goes through "expect" so the shell command itself fails on a mismatch, the counts
+ * pin down what changed when it does. Replays report every frame regardless of pacing and run
+ * inline, so every test variant gets the same stream.
+ */
+struct replay_golden {
+    uint8_t layer;
+    const char *cmd;
+    struct replay_result expect;
+};
+
+static const struct replay_golden replay_goldens[] = {
+    {LAYER_BASE, "ibl replay gen circle 1000 300", {600, 300, 0, 0x6b14deca}},
+    {LAYER_BASE, "ibl replay gen jitter 1000 300", {600, 256, 0, 0x633bfc0e}},
+    {LAYER_BASE, "ibl replay gen scroll 125 50", {50, 50, 0, 0xee115c3b}},
+    {LAYER_SCALE, "ibl replay gen circle 1000 300", {600, 65, 0, 0x13929e57}},
+    {LAYER_M2K, "ibl replay gen flick 1000 300", {320, 0, 30, 0x5f76b57a}},
+    {LAYER_ROTATE, "ibl replay gen flick 1000 300", {320, 155, 0, 0x0abd4ba1}},
+    {LAYER_DEADZONE, "ibl replay gen jitter 125 100", {200, 51, 0, 0xa8837c4e}},
+    {LAYER_ACCEL, "ibl replay gen flick 1000 300", {320, 155, 0, 0x9e56214e}},
+};
+
+ZTEST(listener, test_replay_golden) {
+    char cmd[96];
+
+    for (size_t i = 0; i < ARRAY_SIZE(replay_goldens); i++) {
+        const struct replay_golden *g = &replay_goldens[i];
+
+        test_stubs_reset();
+        zmk_keymap_layer_activate(g->layer);
+        snprintf(cmd, sizeof(cmd), "%s expect %08lx", g->cmd, g->expect.crc);
+        struct replay_result res = replay(cmd);
+        TC_PRINT("layer %u %s: {%lu, %lu, %ld, 0x%08lx}\n", g->layer, g->cmd, res.events,
+                 res.reports, res.keypresses, res.crc);
+
+        zassert_equal(res.events, g->expect.events, "%s on layer %u", g->cmd, g->layer);
+        zassert_equal(res.reports, g->expect.reports, "%s on layer %u", g->cmd, g->layer);
+        zassert_equal(res.keypresses, g->expect.keypresses, "%s on layer %u", g->cmd, g->layer);
+    }
+}
+
+// Bytes in the capture ring as "ibl capture dump" reports them.
+static unsigned long capture_bytes(void) {
+    const struct shell *sh = shell_backend_dummy_get_ptr();
+    unsigned long bytes;
+    size_t size;
+
+    shell_backend_dummy_clear_output(sh);
+    zassert_ok(shell_execute_cmd(sh, "ibl capture dump hex"));
+    const char *out = shell_backend_dummy_get_output(sh, &size);
+    const char *line = strstr(out, "ibl capture v1, ");
+    zassert_not_null(line, "no header in: %s", out);
+    zassert_equal(sscanf(line, "ibl capture v1, %lu bytes", &bytes), 1);
+    return bytes;
+}
+
+ZTEST(listener, test_capture_off_until_started) {
+    const struct shell *sh = shell_backend_dummy_get_ptr();
+
+    zassert_ok(shell_execute_cmd(sh, "ibl capture clear"));
+    input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    zassert_equal(capture_bytes(), 0, "recording before ibl capture start");
+
+    zassert_ok(shell_execute_cmd(sh, "ibl capture start"));
+    input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    zassert_ok(shell_execute_cmd(sh, "ibl capture stop"));
+    input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    zassert_between_inclusive(capture_bytes(), 1, 8, "one record expected");
+    zassert_ok(shell_execute_cmd(sh, "ibl capture clear"));
+}
+
+ZTEST(listener, test_scaler_default_code_matches_nothing) {
+    zmk_keymap_layer_activate(LAYER_SCALE_NONE);
+    input_report_rel(test_trackball, INPUT_REL_X, 8, true, K_FOREVER);
+    settle();
+
+    zassert_equal(test_reports_len, 1);
+    zassert_equal(test_reports[0].x, 8);
+}
+
+ZTEST(listener, test_release_on_other_layer) {
+    input_report_key(test_trackball, INPUT_BTN_0, 1, true, K_FOREVER);
+    settle();
+    zmk_keymap_layer_activate(LAYER_SCALE);
+    // the scale listener never saw the press, the host still has to see the release
+    input_report_key(test_trackball, INPUT_BTN_0, 0, true, K_FOREVER);
+    settle();
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(test_reports[0].buttons, BIT(0));
+    zassert_equal(test_reports[1].buttons, 0);
+}
+
+ZTEST(listener, test_back_to_back_clicks) {
+    // press and release in their own syncs, then both within one frame
+    input_report_key(test_trackball, INPUT_BTN_0, 1, true, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 0, true, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_1, 1, false, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_1, 0, true, K_FOREVER);
+    settle();
+
+    zassert_equal(test_reports_len, 4);
+    zassert_equal(test_reports[0].buttons, BIT(0));
+    zassert_equal(test_reports[1].buttons, 0);
+    zassert_equal(test_reports[2].buttons, BIT(1));
+    zassert_equal(test_reports[3].buttons, 0);
+}
+
+ZTEST(listener, test_overflow_motion_before_button) {
+    // more deltas than the deferred ring holds, then a click, all before the consumer runs
+    for (int i = 0; i < 100; i++) {
+        input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    }
+    input_report_key(test_trackball, INPUT_BTN_0, 1, true, K_FOREVER);
+    settle();
+    input_report_key(test_trackball, INPUT_BTN_0, 0, true, K_FOREVER);
+    settle();
+
+    int32_t x = 0;
+    uint32_t i = 0;
+    for (; i < test_reports_len && !test_reports[i].buttons; i++) {
+        x += test_reports[i].x;
+    }
+    zassert_true(i < test_reports_len, "click never reported");
+    // motion parked in the merged set goes out with or ahead of the click, never after it
+    x += test_reports[i].x;
+    zassert_equal(x, 100);
+    for (i++; i < test_reports_len; i++) {
+        zassert_equal(test_reports[i].x, 0);
+    }
+}
+
+ZTEST(listener, test_motion_keeps_button_order) {
+    input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 1, true, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_X, 2, true, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 0, true, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_X, 4, true, K_FOREVER);
+    settle();
+
+    // each delta has to reach the host with the button state it was made in, or it drags
+    int32_t before_press = 0, held = 0, after_release = 0;
+    bool pressed = false, released = false;
+    for (uint32_t i = 0; i < test_reports_len; i++) {
+        if (test_reports[i].buttons) {
+            zassert_false(released, "button pressed again in report %u", i);
+            pressed = true;
+            held += test_reports[i].x;
+        } else if (pressed) {
+            released = true;
+            after_release += test_reports[i].x;
+        } else {
+            before_press += test_reports[i].x;
+        }
+    }
+    zassert_equal(before_press, 1);
+    zassert_equal(held, 2);
+    zassert_equal(after_release, 4);
+}
+
+ZTEST(listener, test_rotation_carries_remainder) {
+    zmk_keymap_layer_activate(LAYER_ROTATE);
+    // each count is 0.707 on both axes at 45 degrees, truncated per frame nothing would move
+    for (int i = 0; i < 10; i++) {
+        input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    }
+    settle();
+
+    int32_t x = 0, y = 0;
+    for (uint32_t i = 0; i < test_reports_len; i++) {
+        x += test_reports[i].x;
+        y += test_reports[i].y;
+    }
+    zassert_equal(x, 7);
+    zassert_equal(y, 7);
+}
+
+ZTEST(listener, test_abs_to_rel) {
+    // the first sample of a touch only sets the origin
+    input_report_abs(test_trackball, INPUT_ABS_X, 100, false, K_FOREVER);
+    input_report_abs(test_trackball, INPUT_ABS_Y, 50, true, K_FOREVER);
+    input_report_abs(test_trackball, INPUT_ABS_X, 110, false, K_FOREVER);
+    input_report_abs(test_trackball, INPUT_ABS_Y, 45, true, K_FOREVER);
+    k_msleep(2);
+    // lifting the finger makes the next touch start over wherever it lands
+    input_report_key(test_trackball, INPUT_BTN_TOUCH, 0, true, K_FOREVER);
+    input_report_abs(test_trackball, INPUT_ABS_X, 900, false, K_FOREVER);
+    input_report_abs(test_trackball, INPUT_ABS_Y, 900, true, K_FOREVER);
+    input_report_abs(test_trackball, INPUT_ABS_X, 897, true, K_FOREVER);
+    settle();
+
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(test_reports[0].x, 10);
+    zassert_equal(test_reports[0].y, -5);
+    zassert_equal(test_reports[1].x, -3);
+    zassert_equal(test_reports[1].y, 0);
+}
+
+ZTEST(listener, test_deadzone) {
+    zmk_keymap_layer_activate(LAYER_DEADZONE);
+    // a resting sensor dithering by one count, within one leak window
+    for (int i = 0; i < 6; i++) {
+        input_report_rel(test_trackball, INPUT_REL_X, (i & 1) ? -1 : 1, true, K_FOREVER);
+        k_msleep(8);
+    }
+    zassert_equal(test_reports_len, 0, "jitter reported");
+
+    // real motion goes out with what was held back, then passes untouched
+    input_report_rel(test_trackball, INPUT_REL_X, 3, true, K_FOREVER);
+    k_msleep(8);
+    input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    settle();
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(test_reports[0].x, 3);
+    zassert_equal(test_reports[1].x, 1);
+}
+
+ZTEST(listener, test_deadzone_diagonal_start) {
+    zmk_keymap_layer_activate(LAYER_DEADZONE);
+    // y comes first in the frame and is held back, then x crosses the threshold
+    input_report_rel(test_trackball, INPUT_REL_Y, 2, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_X, 3, true, K_FOREVER);
+    k_msleep(8);
+    input_report_rel(test_trackball, INPUT_REL_X, 1, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_Y, 1, true, K_FOREVER);
+    settle();
+
+    int32_t x = 0, y = 0;
+    for (uint32_t i = 0; i < test_reports_len; i++) {
+        x += test_reports[i].x;
+        y += test_reports[i].y;
+    }
+    zassert_equal(x, 4);
+    zassert_equal(y, 3, "%d of y held back at the start", 3 - y);
+}
+
+// Reported x for count frames of delta counts, period_ms apart.
+static int32_t accel_stroke(uint32_t count, int32_t delta, uint32_t period_ms) {
+    uint32_t first = test_reports_len;
+    int32_t x = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        input_report_rel(test_trackball, INPUT_REL_X, delta, true, K_FOREVER);
+        k_msleep(period_ms);
+    }
+    settle();
+    for (uint32_t i = first; i < test_reports_len; i++) {
+        x += test_reports[i].x;
+    }
+    return x;
+}
+
+ZTEST(listener, test_accel_lut) {
+    zmk_keymap_layer_activate(LAYER_ACCEL);
+    // 20 counts/s reads the first table entry, 1x
+    zassert_equal(accel_stroke(10, 1, 50), 10);
+    // 1000 counts/s is past 64, 3x once the speed estimate has caught up
+    int32_t fast = accel_stroke(50, 1, 1);
+    TC_PRINT("accel: 50 counts at 1 kHz came out as %d\n", fast);
+    zassert_true(fast > 2 * 50 && fast <= 3 * 50, "%d counts", fast);
+}
+
+ZTEST(listener, test_accel_derived_step) {
+    zmk_keymap_layer_activate(LAYER_ACCEL_WIDE);
+    // 4000 counts/s is the top of the curve, 3x. A step of 64 would have stopped the table at
+    // 1984 counts/s, short of 2x.
+    int32_t fast = accel_stroke(50, 4, 1);
+    TC_PRINT("accel: 200 counts at 4000 counts/s came out as %d\n", fast);
+    zassert_true(fast > 5 * 200 / 2 && fast <= 3 * 200, "%d counts", fast);
+}
+
+ZTEST(listener, test_frame_api) {
+    zmk_keymap_layer_activate(LAYER_FRAME);
+    input_report_rel(test_trackball, INPUT_REL_X, 3, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_Y, 5, false, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 1, true, K_FOREVER);
+    k_msleep(20);
+
+    // the scaler halved the frame as a whole and tog-layer took what was left of it
+    zassert_true(zmk_keymap_layer_active(LAYER_TOG_BENCH));
+    zassert_equal(test_reports_len, 1);
+    zassert_equal(test_reports[0].x, 1);
+    zassert_equal(test_reports[0].y, 2);
+    zassert_equal(test_reports[0].buttons, BIT(0));
+
+    // both halves left over add up with the next frame
+    input_report_rel(test_trackball, INPUT_REL_X, 1, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_Y, 1, false, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 0, true, K_FOREVER);
+    settle();
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(test_reports[1].x, 1);
+    zassert_equal(test_reports[1].y, 1);
+    zassert_equal(test_reports[1].buttons, 0);
+}
+
+ZTEST(listener, test_tog_layer_activation_distance) {
+    zmk_keymap_layer_activate(LAYER_TOG_DIST);
+    // 15 counts, then 15 more after the 50 ms window has moved on
+    input_report_rel(test_trackball, INPUT_REL_X, 15, true, K_FOREVER);
+    k_msleep(60);
+    input_report_rel(test_trackball, INPUT_REL_X, 15, true, K_FOREVER);
+    k_msleep(5);
+    zassert_false(zmk_keymap_layer_active(LAYER_TOG_DIST_TARGET), "woken below the distance");
+
+    // 5 more inside the same window make 20
+    input_report_rel(test_trackball, INPUT_REL_X, 5, true, K_FOREVER);
+    k_msleep(5);
+    zassert_true(zmk_keymap_layer_active(LAYER_TOG_DIST_TARGET), "not woken at the distance");
+
+    // any input keeps it alive, idle for the time to live drops it
+    k_msleep(80);
+    input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    k_msleep(80);
+    zassert_true(zmk_keymap_layer_active(LAYER_TOG_DIST_TARGET), "dropped while in use");
+    k_msleep(40);
+    zassert_false(zmk_keymap_layer_active(LAYER_TOG_DIST_TARGET), "kept past its time to live");
+
+    // the gate only holds back the layer, never the motion
+    int32_t x = 0;
+    for (uint32_t i = 0; i < test_reports_len; i++) {
+        x += test_reports[i].x;
+    }
+    zassert_equal(x, 36);
+}
+
+ZTEST(listener, test_tog_layer_activation_frames) {
+    zmk_keymap_layer_activate(LAYER_TOG_EVENTS);
+    // two frames of two events each are two events, short of three
+    for (int i = 0; i < 2; i++) {
+        input_report_rel(test_trackball, INPUT_REL_X, 1, false, K_FOREVER);
+        input_report_rel(test_trackball, INPUT_REL_Y, 1, true, K_FOREVER);
+    }
+    k_msleep(5);
+    zassert_false(zmk_keymap_layer_active(LAYER_TOG_EVENTS_TARGET), "events counted per frame");
+
+    input_report_rel(test_trackball, INPUT_REL_X, 1, true, K_FOREVER);
+    k_msleep(5);
+    zassert_true(zmk_keymap_layer_active(LAYER_TOG_EVENTS_TARGET), "not woken by the third frame");
+
+    // idle for the time to live drops it, then one frame with the distance wakes it on its own
+    k_msleep(120);
+    zassert_false(zmk_keymap_layer_active(LAYER_TOG_EVENTS_TARGET));
+    input_report_rel(test_trackball, INPUT_REL_X, 25, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_Y, -15, true, K_FOREVER);
+    k_msleep(5);
+    zassert_true(zmk_keymap_layer_active(LAYER_TOG_EVENTS_TARGET), "not woken by the distance");
+    settle();
+}
+
+// The frame that wakes the target layer comes out of its listener only, x inverted there.
+static void assert_woken_frame(void) {
+    zassert_equal(test_reports_len, 1);
+    zassert_equal(test_reports[0].x, -5);
+    zassert_equal(test_reports[0].y, 3);
+    zassert_equal(test_reports[0].buttons, BIT(0));
+}
+
+static void send_waking_frame(void) {
+    input_report_rel(test_trackball, INPUT_REL_X, 5, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_Y, 3, false, K_FOREVER);
+    input_report_key(test_trackball, INPUT_BTN_0, 1, true, K_FOREVER);
+    // look before the 100 ms time-to-live drops the layer and the release goes out
+    k_msleep(20);
+}
+
+ZTEST(listener, test_sync_activation_hands_over_event) {
+    zmk_keymap_layer_activate(LAYER_TOG_SYNC);
+    send_waking_frame();
+
+    // x woke the layer, y and the button already went to its listener on their own
+    assert_woken_frame();
+    input_report_key(test_trackball, INPUT_BTN_0, 0, true, K_FOREVER);
+    settle();
+}
+
+ZTEST(listener, test_sync_activation_hands_over_frame) {
+    zmk_keymap_layer_activate(LAYER_TOG_SYNC_FRAME);
+    send_waking_frame();
+
+    // the whole frame woke the layer at the sync, none of it may stay with the old listener
+    assert_woken_frame();
+    input_report_key(test_trackball, INPUT_BTN_0, 0, true, K_FOREVER);
+    settle();
+}
+
+ZTEST_SUITE(saturation, NULL, NULL, before, NULL, NULL);
+
+struct report_sum {
+    int32_t x;
+    int32_t y;
+    int32_t scroll_y;
+};
+
+// Every report has to stay in its HID field, nothing may wrap or be clamped away.
+static struct report_sum sum_reports(void) {
+    struct report_sum sum = {0};
+    for (uint32_t i = 0; i < test_reports_len; i++) {
+        zassert_true(test_reports[i].x != INT16_MIN && test_reports[i].y != INT16_MIN);
+        zassert_true(test_reports[i].scroll_y != INT8_MIN);
+        sum.x += test_reports[i].x;
+        sum.y += test_reports[i].y;
+        sum.scroll_y += test_reports[i].scroll_y;
+    }
+    return sum;
+}
+
+ZTEST(saturation, test_single_event_split) {
+    input_report_rel(test_trackball, INPUT_REL_X, 40000, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_Y, -40000, true, K_FOREVER);
+    settle();
+
+    struct report_sum sum = sum_reports();
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(test_reports[0].x, INT16_MAX);
+    zassert_equal(test_reports[0].y, -INT16_MAX);
+    zassert_equal(sum.x, 40000);
+    zassert_equal(sum.y, -40000);
+}
+
+ZTEST(saturation, test_coalesced_sync_split) {
+    // a 12k CPI flick landing in one sync
+    for (int i = 0; i < 5; i++) {
+        input_report_rel(test_trackball, INPUT_REL_X, 20000, false, K_FOREVER);
+    }
+    input_report_rel(test_trackball, INPUT_REL_Y, 1, true, K_FOREVER);
+    settle();
+
+    struct report_sum sum = sum_reports();
+    zassert_equal(test_reports_len, 4);
+    zassert_equal(sum.x, 100000);
+    zassert_equal(sum.y, 1);
+}
+
+ZTEST(saturation, test_wheel_split) {
+    input_report_rel(test_trackball, INPUT_REL_WHEEL, 300, true, K_FOREVER);
+    settle();
+
+    struct report_sum sum = sum_reports();
+    zassert_equal(test_reports_len, 3);
+    zassert_equal(test_reports[0].scroll_y, INT8_MAX);
+    zassert_equal(sum.scroll_y, 300);
+}
+
+ZTEST(saturation, test_scaler_no_wrap) {
+    zmk_keymap_layer_activate(LAYER_SCALE_UP);
+    // 2000 * 30 is past int16_t, it used to come out as -5536
+    input_report_rel(test_trackball, INPUT_REL_X, 2000, true, K_FOREVER);
+    settle();
+
+    struct report_sum sum = sum_reports();
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(sum.x, 60000);
+}
+
+ZTEST(saturation, test_multiplier_no_wrap) {
+    zmk_keymap_layer_activate(LAYER_MULTIPLIER);
+    input_report_rel(test_trackball, INPUT_REL_X, -12000, false, K_FOREVER);
+    input_report_rel(test_trackball, INPUT_REL_Y, 9000, true, K_FOREVER);
+    settle();
+
+    struct report_sum sum = sum_reports();
+    zassert_equal(test_reports_len, 2);
+    zassert_equal(sum.x, -48000);
+    zassert_equal(sum.y, 36000);
+}
+
+ZTEST(saturation, test_m2k_no_wrap) {
+    zmk_keymap_layer_activate(LAYER_M2K);
+    // 40000 used to wrap to -25536 in the 16-bit delta and tap left
+    input_report_rel(test_trackball, INPUT_REL_X, 40000, true, K_FOREVER);
+    settle();
+
+    zassert_true(test_keys_len > 0);
+    for (uint32_t i = 0; i < test_keys_len; i++) {
+        zassert_equal(test_keys[i].keycode, 0, "tapped %u instead of right",
+                      test_keys[i].keycode);
+    }
+}
+
+ZTEST_SUITE(smoothing, NULL, NULL, before, NULL, NULL);
+
+// One x delta per frame, frames period_ms apart on the kernel clock.
+static void play_frames(const int32_t *deltas, uint32_t count, uint32_t period_ms) {
+    int64_t start = k_uptime_get();
+
+    for (uint32_t i = 0; i < count; i++) {
+        k_sleep(K_TIMEOUT_ABS_MS(start + (int64_t)(i + 1) * period_ms));
+        input_report_rel(test_trackball, INPUT_REL_X, deltas[i], true, K_FOREVER);
+    }
+}
+
+static int32_t reported_x(uint32_t first) {
+    int32_t sum = 0;
+    for (uint32_t i = first; i < test_reports_len; i++) {
+        sum += test_reports[i].x;
+    }
+    return sum;
+}
+
+// Returns the motion reported once the stroke has settled.
+static int32_t run_frames(const int32_t *deltas, uint32_t count, uint32_t period_ms) {
+    uint32_t first = test_reports_len;
+    play_frames(deltas, count, period_ms);
+    settle();
+    return reported_x(first);
+}
+
+/*
+ * A slow stroke at 1 kHz that jumps to a fast flick: the filter may lag behind the step but
+ * never run ahead of the input, and all of it comes out once the stroke has ended.
+ */
+ZTEST(smoothing, test_step_no_overshoot) {
+    static int32_t stroke[70];
+    const uint32_t slow_frames = 20;
+    const int32_t speed = 50;
+    int32_t in = 0;
+
+    zmk_keymap_layer_activate(LAYER_SMOOTH);
+    for (uint32_t i = 0; i < ARRAY_SIZE(stroke); i++) {
+        stroke[i] = i < slow_frames ? 1 : speed;
+        in += stroke[i];
+    }
+
+    play_frames(stroke, ARRAY_SIZE(stroke), 1);
+    // the deferred thread catches up well before the stroke counts as ended
+    k_msleep(10);
+    int32_t held = in - reported_x(0);
+
+    zassert_true(held >= 0, "filter overshot by %d", -held);
+
+    settle();
+    zassert_equal(reported_x(0), in, "%d counts never came out", in - reported_x(0));
+}
+
+/*
+ * A frame the sensor stops sending halfway while the idle flush comes due must not be reported
+ * half by the flush, it goes out whole once its sync arrives.
+ */
+ZTEST(smoothing, test_idle_flush_waits_for_open_frame) {
+    static const int32_t stroke[] = {10, 20, 40, 40};
+
+    zmk_keymap_layer_activate(LAYER_SMOOTH);
+    play_frames(stroke, ARRAY_SIZE(stroke), 1);
+    k_msleep(5);
+    input_report_rel(test_trackball, INPUT_REL_X, 40, false, K_FOREVER);
+    uint32_t before = test_reports_len;
+    k_msleep(2 * ZMK_INPUT_BEHAVIOR_FLUSH_IDLE_MS);
+    zassert_equal(test_reports_len, before, "open frame flushed");
+
+    input_report_rel(test_trackball, INPUT_REL_Y, 7, true, K_FOREVER);
+    settle();
+
+    int32_t y = 0;
+    for (uint32_t i = 0; i < test_reports_len; i++) {
+        y += test_reports[i].y;
+    }
+    zassert_equal(reported_x(0), 150);
+    zassert_equal(y, 7);
+}
+
+// Sub-pixel back and forth at 125 Hz is the jitter the filter is for.
+ZTEST(smoothing, test_slow_jitter_damped) {
+    static int32_t jitter[40];
+    int32_t in = 0;
+    int32_t out = 0;
+
+    zmk_keymap_layer_activate(LAYER_SMOOTH);
+    for (uint32_t i = 0; i < ARRAY_SIZE(jitter); i++) {
+        jitter[i] = (i & 1) ? -2 : 2;
+        in += abs(jitter[i]);
+    }
+
+    run_frames(jitter, ARRAY_SIZE(jitter), 8);
+    for (uint32_t i = 0; i < test_reports_len; i++) {
+        out += abs(test_reports[i].x);
+    }
+    TC_PRINT("smooth jitter: %d counts in, %d out\n", in, out);
+
+    zassert_true(out * 2 < in, "only damped to %d of %d", out, in);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * The parts of ZMK the input behaviors link against: keymap, mouse HID report, endpoints, the
+ * event manager and a key behavior standing in for &kp. Everything is recorded for the tests.
+ */
+
+#include <zephyr/device.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include <drivers/behavior.h>
+#include <zmk/behavior.h>
+#include <zmk/endpoints.h>
+#include <zmk/event_manager.h>
+#include <zmk/events/keycode_state_changed.h>
+#include <zmk/events/layer_state_changed.h>
+#include <zmk/hid.h>
+#include <zmk/input_behavior.h>
+#include <zmk/keymap.h>
+
+#include "test_stubs.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+struct test_report test_reports[TEST_LOG_LEN];
+uint32_t test_reports_len;
+struct test_key test_keys[TEST_LOG_LEN];
+uint32_t test_keys_len;
+
+static struct test_report hid;
+
+const struct device *zmk_behavior_get_binding(const char *name) {
+    return device_get_binding(name);
+}
+
+// Event manager, in link order and on the raising thread like ZMK's.
+
+ZMK_EVENT_IMPL(zmk_layer_state_changed);
+ZMK_EVENT_IMPL(zmk_keycode_state_changed);
+
+int zmk_event_manager_raise(zmk_event_t *event) {
+    STRUCT_SECTION_FOREACH(zmk_event_subscription, sub) {
+        if (sub->event_type != event->event) {
+            continue;
+        }
+        int ret = sub->listener->callback(event);
+        if (ret != ZMK_EV_EVENT_BUBBLE) {
+            return ret < 0 ? ret : 0;
+        }
+    }
+    return 0;
+}
+
+// Keymap
+
+static zmk_keymap_layers_state_t layer_state = BIT(0);
+
+zmk_keymap_layers_state_t zmk_keymap_layer_state(void) { return layer_state; }
+
+bool zmk_keymap_layer_active(uint8_t layer) { return layer_state & BIT(layer); }
+
+uint8_t zmk_keymap_highest_layer_active(void) {
+    return layer_state ? 31 - __builtin_clz(layer_state) : 0;
+}
+
+static int set_layer_state(uint8_t layer, bool state) {
+    if (layer >= ZMK_KEYMAP_LAYERS_LEN || (layer == 0 && !state)) {
+        return -EINVAL;
+    }
+    if (zmk_keymap_layer_active(layer) == state) {
+        return 0;
+    }
+    WRITE_BIT(layer_state, layer, state);
+    return raise_zmk_layer_state_changed((struct zmk_layer_state_changed){
+        .layer = layer, .state = state, .timestamp = k_uptime_get()});
+}
+
+int zmk_keymap_layer_activate(uint8_t layer) { return set_layer_state(layer, true); }
+
+int zmk_keymap_layer_deactivate(uint8_t layer) { return set_layer_state(layer, false); }
+
+// Mouse HID report and endpoints
+
+void zmk_hid_mouse_movement_set(int16_t x, int16_t y) {
+    hid.x = x;
+    hid.y = y;
+}
+
+void zmk_hid_mouse_scroll_set(int8_t x, int8_t y) {
+    hid.scroll_x = x;
+    hid.scroll_y = y;
+}
+
+int zmk_hid_mouse_button_press(uint8_t button) {
+    WRITE_BIT(hid.buttons, button, 1);
+    return 0;
+}
+
+int zmk_hid_mouse_button_release(uint8_t button) {
+    WRITE_BIT(hid.buttons, button, 0);
+    return 0;
+}
+
+struct zmk_endpoint_instance zmk_endpoints_selected(void) {
+    return (struct zmk_endpoint_instance){.transport = ZMK_TRANSPORT_USB};
+}
+
+int zmk_endpoints_send_mouse_report(void) {
+    if (test_reports_len < ARRAY_SIZE(test_reports)) {
+        test_reports[test_reports_len++] = hid;
+    }
+    return 0;
+}
+
+void test_stubs_reset(void) {
+    for (uint8_t layer = ZMK_KEYMAP_LAYERS_LEN - 1; layer > 0; layer--) {
+        zmk_keymap_layer_deactivate(layer);
+    }
+    zmk_input_behavior_reset_all();
+    hid = (struct test_report){0};
+    test_reports_len = 0;
+    test_keys_len = 0;
+}
+
+// Input device the listeners are bound to, it only has to exist.
+
+DEVICE_DT_DEFINE(DT_NODELABEL(trackball), NULL, NULL, NULL, NULL, POST_KERNEL,
+                 CONFIG_KERNEL_INIT_PRIORITY_DEFAULT, NULL);
+
+const struct device *const test_trackball = DEVICE_DT_GET(DT_NODELABEL(trackball));
+
+// Recorder standing in for &kp, param1 is the keycode.
+
+#define DT_DRV_COMPAT test_behavior_recorder
+
+static int recorder_binding(struct zmk_behavior_binding *binding,
+                            struct zmk_behavior_binding_event event, bool pressed) {
+    if (test_keys_len < ARRAY_SIZE(test_keys)) {
+        test_keys[test_keys_len++] = (struct test_key){
+            .keycode = binding->param1, .pressed = pressed, .timestamp = event.timestamp};
+    }
+    raise_zmk_keycode_state_changed((struct zmk_keycode_state_changed){
+        .usage_page = 0x07,
+        .keycode = binding->param1,
+        .state = pressed,
+        .timestamp = event.timestamp,
+    });
+    return ZMK_BEHAVIOR_OPAQUE;
+}
+
+static int recorder_binding_pressed(struct zmk_behavior_binding *binding,
+                                    struct zmk_behavior_binding_event event) {
+    return recorder_binding(binding, event, true);
+}
+
+static int recorder_binding_released(struct zmk_behavior_binding *binding,
+                                     struct zmk_behavior_binding_event event) {
+    return recorder_binding(binding, event, false);
+}
+
+static const struct behavior_driver_api recorder_driver_api = {
+    .binding_pressed = recorder_binding_pressed,
+    .binding_released = recorder_binding_released,
+};
+
+BEHAVIOR_DT_INST_DEFINE(0, NULL, NULL, NULL, NULL, POST_KERNEL,
+                        CONFIG_KERNEL_INIT_PRIORITY_DEFAULT, &recorder_driver_api);
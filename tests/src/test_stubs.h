@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2024 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/device.h>
+
+#define TEST_LOG_LEN 256
+
+// Mouse report as zmk_endpoints_send_mouse_report() saw it.
+struct test_report {
+    int16_t x;
+    int16_t y;
+    int8_t scroll_x;
+    int8_t scroll_y;
+    uint8_t buttons;
+};
+
+// Press or release of the recorder behavior.
+struct test_key {
+    uint32_t keycode;
+    bool pressed;
+    int64_t timestamp;
+};
+
+extern struct test_report test_reports[TEST_LOG_LEN];
+extern uint32_t test_reports_len;
+extern struct test_key test_keys[TEST_LOG_LEN];
+extern uint32_t test_keys_len;
+
+extern const struct device *const test_trackball;
+
+// Back to layer 0 with empty logs and every input behavior in its boot state.
+void test_stubs_reset(void);